@@ -1,61 +1,44 @@
 #ifndef LCD_SYMBOLS_HPP
 #define LCD_SYMBOLS_HPP
 
-// Instanciated lcd object from Hot_Air_Sterilizer.ino file
+// Instanciated lcd object and its framebuffer from Hot_Air_Sterilizer.ino file
 extern LiquidCrystal_I2C lcd;
+extern lcd_framebuffer lcd_fb;
+
+// Custom glyphs, two blink phases each (SCREEN_GLYPH fields of lcd_screen.hpp)
+#define GLYPH_SET   0
+#define GLYPH_HEAT  2
+#define GLYPH_VENT  4
 
 namespace lcd_symbols
 {
-	byte setChar_1[8] =  { 0b00000, 0b00010, 0b00110, 0b01110, 0b00110, 0b00010, 0b00000, 0b00000};
-	byte setChar_2[8] =  { 0b00000, 0b00001, 0b00010, 0b00100, 0b00010, 0b00001, 0b00000, 0b00000};
-	byte heatChar_1[8] = { 0b01000, 0b10101, 0b00010, 0b00000, 0b01000, 0b10101, 0b00010, 0b00000};
-	byte heatChar_2[8] = { 0b00000, 0b01000, 0b10101, 0b00010, 0b00000, 0b01000, 0b10101, 0b00010};
-	byte ventChar_1[8] = { 0b00000, 0b00000, 0b01100, 0b00101, 0b11011, 0b10100, 0b00110, 0b00000};
-	byte ventChar_2[8] = { 0b00000, 0b00000, 0b00010, 0b11010, 0b00100, 0b01011, 0b01000, 0b00000};
+	const byte glyphs[6][8] PROGMEM = {
+		{ 0b00000, 0b00010, 0b00110, 0b01110, 0b00110, 0b00010, 0b00000, 0b00000},   // set
+		{ 0b00000, 0b00001, 0b00010, 0b00100, 0b00010, 0b00001, 0b00000, 0b00000},
+		{ 0b01000, 0b10101, 0b00010, 0b00000, 0b01000, 0b10101, 0b00010, 0b00000},   // heat
+		{ 0b00000, 0b01000, 0b10101, 0b00010, 0b00000, 0b01000, 0b10101, 0b00010},
+		{ 0b00000, 0b00000, 0b01100, 0b00101, 0b11011, 0b10100, 0b00110, 0b00000},   // vent
+		{ 0b00000, 0b00000, 0b00010, 0b11010, 0b00100, 0b01011, 0b01000, 0b00000}
+	};
 	  
 	void create()
 	{
-		lcd.createChar(0, setChar_1);
-		lcd.createChar(1, setChar_2);
-		lcd.createChar(2, heatChar_1);
-		lcd.createChar(3, heatChar_2);
-		lcd.createChar(4, ventChar_1);
-		lcd.createChar(5, ventChar_2);
-	}
-	
-	inline void set(const byte &col, const byte &row)
-	{
-		int heatSymbolTimeDelta = millis() % 2000;
-		lcd.setCursor(col, row);  
-		if (heatSymbolTimeDelta <= 1000) {
-			lcd.write(0);
-		} else if (heatSymbolTimeDelta > 1000) {
-			lcd.write(1);
+		// from flash through one row of RAM
+		byte glyph[8];
+		for ( byte i = 0; i < 6; ++i ) {
+			for ( byte j = 0; j < 8; ++j ) {
+				glyph[j] = pgm_read_byte(&glyphs[i][j]);
+			}
+			lcd.createChar(i, glyph);
 		}
 	}
 	
-	inline void heat(const byte &col, const byte &row)
+	// blink phase of the glyphs, 0 or 1, to be added to GLYPH_*
+	inline byte phase()
 	{
-		int heatSymbolTimeDelta = millis() % 2000; 
-		lcd.setCursor(col, row);    
-		if (heatSymbolTimeDelta <= 1000) {
-			lcd.write(2);
-		} else if (heatSymbolTimeDelta > 1000) {
-			lcd.write(3);
-		}
-	}
-	
-	inline void vent(const byte &col, const byte &row)
-	{
-		int heatSymbolTimeDelta = millis() % 2000;
-		lcd.setCursor(col, row);  
-		if (heatSymbolTimeDelta <= 1000) {
-			lcd.write(4);
-		} else if (heatSymbolTimeDelta > 1000) {
-			lcd.write(5);
-		}
+		return millis() % 2000 > 1000;
 	}
 	
 }
 
-#endif // LCD_SYMBOLS_HPP
+#endif // LCD_SYMBOLS_HPP
@@ -1,10 +1,24 @@
 #include <Wire.h> 
 #include <LiquidCrystal_I2C.h> // https://github.com/marcoschwartz/LiquidCrystal_I2C
-#include <Adafruit_MAX31865.h> // https://github.com/adafruit/Adafruit_MAX31865
+#include "lcd_buffer.hpp"
 #include "LCD_symbols.hpp"
-#include "button_handler.hpp"
+#include "lcd_screen.hpp"
+#include "button_bank.hpp"
+#include "buzzer.hpp"
 #include "mode_control.hpp"
 #include "flow_control.hpp"
+#include "max31865.hpp"
+#include "sensor_filter.hpp"
+#include "scheduler.hpp"
+#include "profiler.hpp"
+#include "serial_tx.hpp"
+#include "telemetry.hpp"
+#include "zone_bank.hpp"
+#include "run_history.hpp"
+#include "cycle_log.hpp"
+#include "safety_monitor.hpp"
+#include "power_idle.hpp"
+#include "serial_command.hpp"
 
 
 // I2C 1602 display
@@ -12,350 +26,771 @@
 #define LCD_COLS  16
 #define LCD_ROWS  2
 
+// MAX31865 bus: 0 software SPI on the pins below, 1 the SPI peripheral
+// (D11 MOSI, D12 MISO, D13 SCK, about 10 times less time per sample).
+// The peripheral takes D11...D13, so the buttons move to A0...A3 and there
+// are no pins left for a second zone.
+#define MAX31865_HW_SPI  0
+
 // MAX31865 controller pinout (software SPI)
 #define PIN_SPI_CS   2
 #define PIN_SPI_SDI  3
 #define PIN_SPI_SDO  4
 #define PIN_SPI_CLK  5
 
+// Zones: chambers with their own MAX31865 (chip select on the shared SPI lines)
+// and heater and vent relays. Zone 0 is the chamber of the display and buttons,
+// the others follow its setpoint. On the Uno the free pins are enough for two.
+#define ZONE_COUNT  1
+
+#define PIN_ZONE1_CS    13
+#define PIN_ZONE1_HEAT  A0
+#define PIN_ZONE1_VENT  A1
+
+const byte zone_cs_pins[] PROGMEM   = { PIN_SPI_CS, PIN_ZONE1_CS };
+const byte zone_heat_pins[] PROGMEM = { PIN_ZONE1_HEAT };   // zones 1...N-1
+const byte zone_vent_pins[] PROGMEM = { PIN_ZONE1_VENT };
+
+#if ZONE_COUNT < 1 || ZONE_COUNT > 2
+	#error "pins are assigned for 1 or 2 zones"
+#endif
+#if MAX31865_HW_SPI && ZONE_COUNT > 1
+	#error "zone 1 pins are taken by the SPI peripheral and the buttons"
+#endif
+
 // The value of the Rref resistor. Use 430.0! (in MAX31865 controller)
 #define RREF 437.5 //437.37
+#include "rtd_table.hpp"   // RTD code to temperature table, built for RREF
 
 // Relays pinout
 #define PIN_RELAY_HEAT  6
 #define PIN_RELAY_VENT  7
 
 // Buttons pinout
-#define PIN_BUTTON_PLUS    9
-#define PIN_BUTTON_MINUS   10
-#define PIN_BUTTON_SELECT  11
-#define PIN_BUTTON_START   12
+#if MAX31865_HW_SPI
+	#define PIN_BUTTON_PLUS    14   // A0
+	#define PIN_BUTTON_MINUS   15   // A1
+	#define PIN_BUTTON_SELECT  16   // A2
+	#define PIN_BUTTON_START   17   // A3
+#else
+	#define PIN_BUTTON_PLUS    9
+	#define PIN_BUTTON_MINUS   10
+	#define PIN_BUTTON_SELECT  11
+	#define PIN_BUTTON_START   12
+#endif
+
+// button_bank reads the buttons as consecutive bits of one port
+#if (PIN_BUTTON_MINUS != PIN_BUTTON_PLUS + 1) || (PIN_BUTTON_SELECT != PIN_BUTTON_PLUS + 2) || \
+	(PIN_BUTTON_START != PIN_BUTTON_PLUS + 3) || \
+	!((PIN_BUTTON_PLUS >= 8 && PIN_BUTTON_START <= 13) || (PIN_BUTTON_PLUS >= 14 && PIN_BUTTON_START <= 19))
+	#error "buttons must be on consecutive pins of D8...D13 or A0...A5"
+#endif
 
 // Buzzer pinout
 #define PIN_BUZZER  8
 
+// Serial line for telemetry, reports and commands
+#define SERIAL_BAUD  115200
+#define SERIAL_REPLY_MAX  96   // longest command reply, the status line
+
 
 
 
 // Instanciate lcd object 
 LiquidCrystal_I2C lcd(LCD_ADDR, LCD_COLS, LCD_ROWS);
 
-// Instanciate MAX31865 object
-Adafruit_MAX31865 max31865 = Adafruit_MAX31865(PIN_SPI_CS, PIN_SPI_SDI, PIN_SPI_SDO, PIN_SPI_CLK);
-
-// Instanciate button objects
-button_handler button_plus(PIN_BUTTON_PLUS);
-button_handler button_minus(PIN_BUTTON_MINUS);
-button_handler button_select(PIN_BUTTON_SELECT);
-button_handler button_start(PIN_BUTTON_START);
+// Instanciate lcd shadow framebuffer, all screen updates go through it
+lcd_framebuffer lcd_fb(LCD_ADDR);
+
+// Instanciate MAX31865 objects, one converter per zone on a shared bus
+#if MAX31865_HW_SPI
+max31865_hw_bus max31865_spi;
+max31865_bank<ZONE_COUNT, max31865_hw_bus> max31865(max31865_spi, zone_cs_pins);
+#else
+typedef max31865_bus< gpio_pin<PIN_SPI_SDI>, gpio_pin<PIN_SPI_SDO>, gpio_pin<PIN_SPI_CLK> > max31865_sw_bus;
+max31865_sw_bus max31865_spi;
+max31865_bank<ZONE_COUNT, max31865_sw_bus> max31865(max31865_spi, zone_cs_pins);
+#endif
+
+// Instanciate button bank, all buttons are read with one port access
+button_bank<PIN_BUTTON_PLUS> buttons;
+
+// Instanciate low-power idle of the modes 0 and 1, a button edge wakes it
+power_idle<PIN_BUTTON_PLUS> idle;
+
+#if PIN_BUTTON_PLUS < 14
+ISR(PCINT0_vect)
+#else
+ISR(PCINT1_vect)
+#endif
+{
+	idle.pin_change();
+}
 
 // Instanciate mode object
 mode_control mode;
 
 // Instanciate flow object with relays pinouts
-flow_control flow(PIN_RELAY_HEAT, PIN_RELAY_VENT);
+flow_control< gpio_pin<PIN_RELAY_HEAT>, gpio_pin<PIN_RELAY_VENT> > flow;
 
 // Instanciate buzzer object
-buzzer_control buzzer(PIN_BUZZER);
+buzzer_control< gpio_pin<PIN_BUZZER> > buzzer;
+
+// Instanciate non-blocking serial output
+serial_tx serial_out(Serial);
+
+// Instanciate the command line parser of the serial input
+command_line commands;
+
+// Instanciate the profile of the running cycle (RAM) and the summaries of the last cycles (EEPROM)
+run_history history;
+cycle_log cycles;
+
+// Instanciate safety monitor, checks the temperature of every zone against its heater
+safety_monitor<ZONE_COUNT> safety;
 
 
 
 
-/************* Temperature approximation **************/
-float average_temp()
+/************* Temperature filter **************/
+// At the 20 ms conversion rate: median of 5 drops single spikes (40 ms delay),
+// the IIR smooths with an 8 sample time constant (140 ms delay).
+// The optional Kalman stage adapts its gain to the noise it is configured for.
+#define FILTER_MEDIAN_N    5
+#define FILTER_IIR_SHIFT   3
+#define FILTER_KALMAN      0
+#define FILTER_KALMAN_Q    1     // centi-degrees^2 per sample
+#define FILTER_KALMAN_R    9     // centi-degrees^2, MAX31865 + PT100 noise
+
+#if FILTER_KALMAN
+	typedef kalman_filter<FILTER_KALMAN_Q, FILTER_KALMAN_R> filter_kalman_stage;
+#else
+	typedef no_filter filter_kalman_stage;
+#endif
+
+typedef filter_chain< median_filter<FILTER_MEDIAN_N>, filter_chain< iir_filter<FILTER_IIR_SHIFT>, filter_kalman_stage > > temp_filter;
+
+// Instanciate zones, one filter per zone
+zone_bank<ZONE_COUNT, temp_filter> zones(zone_heat_pins, zone_vent_pins);
+
+// The heater relays are switched from the Timer1 compare interrupt (heater_output.hpp),
+// the control task only publishes the duties
+ISR(TIMER1_COMPA_vect)
 {
-	static float curr_temp_sum = 0;
-	static byte temp_probe_count = 0;	
-	static float average_temp = 0;
-	
-	curr_temp_sum += max31865.temperature(100, RREF);
-	++temp_probe_count;
+	flow.heater_tick();
+	zones.heater_tick();
+}
+/************* Temperature filter **************/
+
+/********************************** SCREENS ***********************************/
+// value slots of the main screen
+enum { SLOT_SEGMENT, SLOT_TEMP_LABEL, SLOT_TEMP_BARIER, SLOT_TEMP_SET, SLOT_TEMP, SLOT_HEAT,
+       SLOT_TIME_BARIER, SLOT_TIME_SET, SLOT_ELAPSED, SLOT_AUTOTUNE, SLOT_END, SLOT_VENT, MAIN_SLOTS };
+
+//  Temp 180<  175°C*      Seg2 in place of Temp while a recipe is stored
+//  Time 120<   42m *      AT 3 during the autotune, END after a cycle
+const screen_field main_screen[] PROGMEM = {
+	{  0, 0, SCREEN_TEXT,  3, SLOT_SEGMENT,     0,          "Seg"    },
+	{  3, 0, SCREEN_INT,   1, SLOT_SEGMENT,     0,          ""       },
+	{  0, 0, SCREEN_TEXT,  4, SLOT_TEMP_LABEL,  0,          "Temp"   },
+	{  5, 0, SCREEN_INT,   3, SLOT_TEMP_BARIER, 0,          ""       },
+	{  8, 0, SCREEN_GLYPH, 1, SLOT_TEMP_SET,    GLYPH_SET,  ""       },
+	{ 10, 0, SCREEN_INT,   3, SLOT_TEMP,        0,          ""       },
+	{ 13, 0, SCREEN_TEXT,  2, SCREEN_ALWAYS,    0,          "\337C"  },
+	{ 15, 0, SCREEN_GLYPH, 1, SLOT_HEAT,        GLYPH_HEAT, ""       },
+	{  0, 1, SCREEN_TEXT,  4, SCREEN_ALWAYS,    0,          "Time"   },
+	{  5, 1, SCREEN_INT,   3, SLOT_TIME_BARIER, 0,          ""       },
+	{  8, 1, SCREEN_GLYPH, 1, SLOT_TIME_SET,    GLYPH_SET,  ""       },
+	{ 10, 1, SCREEN_INT,   3, SLOT_ELAPSED,     0,          ""       },
+	{ 13, 1, SCREEN_TEXT,  1, SLOT_ELAPSED,     0,          "m"      },
+	{ 10, 1, SCREEN_TEXT,  2, SLOT_AUTOTUNE,    0,          "AT"     },
+	{ 13, 1, SCREEN_INT,   2, SLOT_AUTOTUNE,    0,          ""       },
+	{ 11, 1, SCREEN_TEXT,  3, SLOT_END,         0,          "END"    },
+	{ 15, 1, SCREEN_GLYPH, 1, SLOT_VENT,        GLYPH_VENT, ""       },
+};
+
+// value slots of the fault screen
+enum { SLOT_RTD_OHMS, SLOT_RTD_TEMP, SLOT_FAULT, SLOT_SAFETY, FAULT_SLOTS };
+
+//  RTD 138.50Ω  98°
+//  Err D7|.|.|.|3|.       Err S2 for a fault of the safety monitor
+const screen_field fault_screen[] PROGMEM = {
+	{  0, 0, SCREEN_TEXT,  3, SCREEN_ALWAYS, 0, "RTD"    },
+	{  4, 0, SCREEN_FIXED, 6, SLOT_RTD_OHMS, 2, ""       },
+	{ 10, 0, SCREEN_TEXT,  1, SCREEN_ALWAYS, 0, "\364"   },
+	{ 11, 0, SCREEN_INT,   4, SLOT_RTD_TEMP, 0, ""       },
+	{ 15, 0, SCREEN_TEXT,  1, SCREEN_ALWAYS, 0, "\337"   },
+	{  0, 1, SCREEN_TEXT,  5, SLOT_FAULT,    0, "Err D"  },
+	{  5, 1, SCREEN_FAULT, 11, SLOT_FAULT,   0, ""       },
+	{  0, 1, SCREEN_TEXT,  5, SLOT_SAFETY,   0, "Err S"  },
+	{  5, 1, SCREEN_INT,   1, SLOT_SAFETY,   0, ""       },
+};
+
+// RTD resistance in 0.01 Ohm per code << 15, folded by the compiler
+#define RREF_CENTI_OHM  ((uint32_t)((RREF) * 100 + 0.5))
+/********************************** SCREENS ***********************************/
+
+
+
+
+/*********************************** TASKS ************************************/
+// Task periods in ms
+#define TASK_SENSOR_MS     (MAX31865_AUTO_MS / ZONE_COUNT)   // one zone per task, each at the converter rate
+#define TASK_CONTROL_MS    100
+#define TASK_BUTTONS_MS    BUTTON_TICK_MS     // debounce tick
+#define TASK_TELEMETRY_MS  50                 // 20 samples per second
+#define TASK_SERIAL_MS     5                  // 115200 baud empties the 64 byte UART buffer in 5.5 ms
+#define TASK_EEPROM_MS     4                  // one byte per task, an EEPROM write takes 3.3 ms
+#define TASK_DISPLAY_MS    200                // 5 Hz
+
+// Task ids, registered in this (priority) order in setup()
+enum { TASK_SENSOR, TASK_CONTROL, TASK_BUTTONS, TASK_BUZZER, TASK_TELEMETRY, TASK_SERIAL, TASK_EEPROM, TASK_DISPLAY, TASK_COUNT };
+
+task_scheduler<TASK_COUNT> scheduler;
+
+// Profiled stages, PROFILING 0 compiles the instrumentation out
+#if PROFILING
+enum { STAGE_LOOP, STAGE_BUTTONS, STAGE_SENSOR, STAGE_CONTROL, STAGE_DISPLAY, STAGE_LCD, STAGE_COUNT };
+
+const char stage_name_loop[] PROGMEM    = "loop";
+const char stage_name_buttons[] PROGMEM = "buttons";
+const char stage_name_sensor[] PROGMEM  = "sensor";
+const char stage_name_control[] PROGMEM = "control";
+const char stage_name_display[] PROGMEM = "display";
+const char stage_name_lcd[] PROGMEM     = "lcd";
+
+const char * const stage_names[STAGE_COUNT] PROGMEM = {
+	stage_name_loop, stage_name_buttons, stage_name_sensor, stage_name_control, stage_name_display, stage_name_lcd
+};
+
+loop_profiler profiler(stage_names, STAGE_COUNT);
+#endif
+
+// The last sensor sample, the sensor is read only when a conversion is done
+uint16_t rtd_code = 0;
+int current_temp_centi = 0;
+byte MAX31865_fault = 0;
+
+// Binary telemetry stream, "telemetry on|off" switches it
+bool telemetry_enabled = true;
+
+// "END" sign after a finished operation
+unsigned long int FinishTimeDelta;
+bool finish_biiset = 0;
+
+
+void task_sensor()
+{
+	PROFILE_STAGE(profiler, STAGE_SENSOR);
 	
-	if ( temp_probe_count == 5 ) {
-		average_temp = curr_temp_sum / temp_probe_count;
-		curr_temp_sum = average_temp * 2;
-		temp_probe_count = 2;
+	byte zone = max31865.poll();
+	if ( zone == MAX31865_NONE ) {
+		return;
 	}
 	
-	return average_temp;
+	uint16_t rtd = max31865.get_rtd(zone);
+	int temp = zones.sample( zone, rtd::to_centi_degrees(rtd), max31865.get_fault(zone) );   // fault status of the same sample
+	
+	if ( zone == 0 ) {
+		rtd_code = rtd;
+		MAX31865_fault = zones.get_fault(0);
+		current_temp_centi = temp;
+	}
+	if ( !zones.get_fault(zone) ) {
+		safety.sample( zone, temp, rtd, zone ? zones.get_heat_duty(zone) : flow.get_heat_duty() );   // at the full sensor rate
+	}
 }
-/************* Temperature approximation **************/
 
-/***************** FAULT DETECTION ********************/
-uint8_t fault_detect()
+
+void task_control()
 {
-	// Check and print any faults
-	uint8_t read_fault = max31865.readFault();
-	uint8_t fault = 0;
-	if (read_fault) {
-		fault = read_fault;
-		max31865.clearFault();
+	PROFILE_STAGE(profiler, STAGE_CONTROL);
+#if PROFILING
+	profiler.record_period( micros(), TASK_CONTROL_MS );   // the PID and the oven model sample on this period
+#endif
+	
+	int current_temp = current_temp_centi / 100;
+	
+	if ( (MAX31865_fault && mode.get_last_mode() != 3) || (current_temp < 0) || (current_temp > 230) ) {
+		mode.set_current_mode(3);
 	}
-	return fault;
-}
-/***************** FAULT DETECTION ********************/
-
-/******************************** PRINT FAULT *********************************/
-void print_fault( float rtd_resistance, int rtd_temperature, byte MAX31865_fault )
-{	
-	lcd.setCursor(0, 0);
-	lcd.print("RTD ");
-	
-	int first_row_pos = 4;
-	lcd.setCursor(first_row_pos, 0);
-	lcd.print( rtd_resistance, 2);
-	
-	if ( rtd_resistance < 10 ) {
-		first_row_pos += 4;
-	} else if ( rtd_resistance < 100 ) {
-		first_row_pos += 5;
-	} else {
-		first_row_pos += 6;
+	for ( byte zone = 1; zone < ZONE_COUNT; ++zone ) {
+		int zone_temp = zones.get_temp(zone) / 100;
+		if ( (zones.get_fault(zone) && mode.get_last_mode() != 3) || (zone_temp < 0) || (zone_temp > 230) ) {
+			mode.set_current_mode(3);   // any zone stops all
+		}
 	}
-	lcd.setCursor(first_row_pos, 0);
-	lcd.print("\364");
-	++first_row_pos;
-	
-	lcd.setCursor(first_row_pos, 0);
-	lcd.print(" ");
-	++first_row_pos;
-	
-	lcd.setCursor(first_row_pos, 0);	
-	lcd.print(rtd_temperature);
-	
-	if ( rtd_temperature < -100  ) {
-		first_row_pos += 4;
-	} else if ( rtd_temperature < -10 &&  rtd_temperature > -100 ) {
-		first_row_pos += 3;
-	} else if ( rtd_temperature < 0 &&  rtd_temperature > -10 ) {
-		first_row_pos += 2;
-	} else if ( rtd_temperature < 10 ) {
-		first_row_pos += 1;
-	} else if ( rtd_temperature < 100 ) {
-		first_row_pos += 2;
-	} else {
-		first_row_pos += 3;
+	bool acknowledged = mode.take_fault_ack();   // PLUS and MINUS or "ack" since the last pass
+	if ( safety.get_fault() ) {
+		if ( acknowledged && mode.get_current_mode() != 3 ) {
+			safety.clear();   // the checks start over
+		} else {
+			mode.set_current_mode(3);
+		}
 	}
-	lcd.setCursor(first_row_pos, 0);
-	lcd.print("\337");
-	++first_row_pos;
-
-	while ( first_row_pos < 16 ) {
-		lcd.setCursor(first_row_pos, 0);
-		lcd.print(" ");
-		++first_row_pos;
+	
+	recipe program;
+	mode.get_recipe( program );   // the stored recipe or the barriers
+	flow.set_zone_span( zones.get_coldest(), zones.get_hottest() );
+	flow.control( mode.get_current_mode(), current_temp_centi, program );
+	zones.control( mode.get_current_mode() == 2 && !flow.is_operation_finished(), flow.get_setpoint() );
+	
+	// run history: one sample per control task while operating, the summary of the cycle goes to EEPROM
+	byte current_mode = mode.get_current_mode();
+	if ( current_mode == 2 && !history.is_running() && !flow.is_operation_finished() ) {
+		uint16_t hold = recipe_total_hold(program);
+		history.start( current_temp_centi, recipe_peak_target(program), hold > 255 ? 255 : hold );
 	}
-			
-	lcd.setCursor(0, 1);
-	lcd.print("Err D");
-	uint8_t i; 
-	uint8_t fault_register;
-	uint8_t second_row_pos = 5;
-
-	for ( i = 128, fault_register = 7; fault_register >= 2; i>>=1, fault_register-- ) {
-		if (MAX31865_fault & i) {
-			lcd.setCursor(second_row_pos, 1);
-			lcd.print(fault_register);
-			++second_row_pos;
+	if ( history.is_running() ) {
+		if ( flow.is_operation_finished() || current_mode != 2 ) {
+			history.finish( flow.is_operation_finished() ? HISTORY_FINISHED : current_mode == 3 ? HISTORY_FAULT : HISTORY_ABORTED );
+			cycles.append( history.get_summary() );
 		} else {
-			lcd.setCursor(second_row_pos, 1);
-			lcd.print(".");
-			++second_row_pos;
-		}
-		if ( fault_register != 2 ) {
-			lcd.setCursor(second_row_pos, 1);
-			lcd.print("|");
-			++second_row_pos;
+			history.sample( current_temp_centi, flow.get_heat_duty(), flow.is_timer_started() );
 		}
 	}
 	
+	if ( flow.is_operation_finished() ) {
+		buzzer.finish();
+		scheduler.trigger(TASK_BUZZER);
+		
+		finish_biiset = 1;
+		FinishTimeDelta = millis();
+		
+		mode.set_current_mode(0);   // All done, back to default mode
+	}
+	
+	const relay_autotune &autotune = flow.get_autotune();
+	if ( autotune.is_finished() ) {
+		mode.set_pid_gains( autotune.get_kp(), autotune.get_ki(), autotune.get_kd() );   // queued for EEPROM
+		flow.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+		zones.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+		
+		buzzer.finish();
+		scheduler.trigger(TASK_BUZZER);
+		
+		mode.set_current_mode(0);
+	} else if ( autotune.is_failed() ) {
+		mode.set_current_mode(0);   // no stable oscillation, gains unchanged
+	}
 }
-/******************************** PRINT FAULT *********************************/
-
 
 
-
-void setup()
-{  
-	lcd.init();                     
-	lcd.backlight();
-	lcd.setCursor(1, 0);
-	lcd.print("GYUMRI MEDICAL");
-	lcd.setCursor(5, 1);
-	lcd.print("CENTER");
-	delay(3000);
-	lcd.clear();
-	
-	lcd_symbols::create();
-	
-	max31865.begin(MAX31865_3WIRE);
-	Serial.begin(9600);
-	
-	// initialize buttons pins
-	button_plus.init();
-	button_minus.init();
-	button_select.init();
-	button_start.init();
-	
-	// intitialize default mode
-	mode.init();
-	//mode.set_temp_barier(111);
-	//mode.set_time_barier(111);
+void task_buttons()
+{
+	PROFILE_STAGE(profiler, STAGE_BUTTONS);
 	
-	// intitialize flow control parameters and relay pins
-	flow.init();
+	mode.control( buttons, buzzer );
 	
-	// initialize buzzer pin
-	buzzer.init();
+	if ( buzzer.is_pending() ) {
+		scheduler.trigger(TASK_BUZZER);
+	}
 }
 
 
-void loop()
+void task_buzzer()
 {
-	mode.control( button_plus, button_minus, button_select, button_start );
-	
-	byte temp_barier = mode.get_temp_barier();
-	byte time_barier = mode.get_time_barier();
-	
-	byte current_mode = mode.get_current_mode();
-	byte last_mode = mode.get_last_mode();
+	buzzer.service();
+}
+
+
+void task_telemetry()
+{
+	if ( !telemetry_enabled || serial_out.availableForWrite() < TELEMETRY_FRAME_MAX ) {
+		return;   // the sample is skipped rather than waiting for the line
+	}
 	
-	int current_temp = int( average_temp() );
-	byte MAX31865_fault = fault_detect();
+	telemetry_record record;
+	record.timestamp = millis();
+	record.rtd = rtd_code;
+	record.temp = current_temp_centi;
+	record.temp_barier = mode.get_temp_barier();
+	record.time_barier = mode.get_time_barier();
+	record.flags = (flow.get_heat_relay_state() ? TELEMETRY_HEAT : 0) | (flow.get_vent_relay_state() ? TELEMETRY_VENT : 0) |
+				   (flow.is_timer_started() ? TELEMETRY_TIMER : 0) | (MAX31865_fault || safety.get_fault() ? TELEMETRY_FAULT : 0);
+	record.mode = mode.get_current_mode();
+	record.elapsed_time = flow.get_elapsed_time();
+	record.heat_duty = flow.get_heat_duty();
 	
-	if ( (MAX31865_fault && last_mode != 3) || (current_temp < 0) || (current_temp > 230) ) {
-		mode.set_current_mode(3);
+	byte frame[TELEMETRY_FRAME_MAX];
+	serial_out.write( frame, telemetry_encode(record, frame) );
+}
+
+
+// Fixed-point value of the command replies, integer formatting as on the display
+void print_fixed( int32_t value, byte decimals )
+{
+	char digits[12];
+	byte length = screen_format( digits + sizeof(digits), value, decimals );
+	serial_out.write( (const uint8_t *)digits + sizeof(digits) - length, length );
+}
+
+
+// One command line (serial_command.hpp), the reply goes out as one line.
+// Mode changes take the transitions of the buttons, parameters change only in the DEFAULT mode.
+void execute_command( byte line )
+{
+	if ( line == COMMAND_TOO_LONG ) {
+		serial_out.println(F("err long"));
+		return;
 	}
 	
-	flow.control( current_mode, current_temp, temp_barier, time_barier );
+	byte count = commands.get_count();
+	byte command = commands.find( 0, command_names, COMMAND_COUNT );
+	byte param = commands.find( 1, parameter_names, MODE_PARAM_COUNT );
+	byte on = commands.find( 1, switch_names, 2 );
+	int32_t value;
 	
-	
-	if ( !MAX31865_fault && current_mode != 3 ) {
-		
-		if ( last_mode == 3 ) {
-			lcd.clear();
-		}
+	switch ( command ) {
+		case COMMAND_STATUS:
+			serial_out.print(F("ok mode "));
+			serial_out.print( mode.get_current_mode() );
+			serial_out.print(F(" temp "));
+			print_fixed( current_temp_centi, 2 );
+			serial_out.print(F(" setpoint "));
+			print_fixed( flow.get_setpoint(), 2 );
+			serial_out.print(F(" segment "));
+			serial_out.print( flow.get_segment() );
+			serial_out.print(F(" elapsed "));
+			serial_out.print( flow.get_elapsed_time() );
+			serial_out.print(F(" duty "));
+			serial_out.print( flow.get_heat_duty() );
+			serial_out.print(F(" fault "));
+			serial_out.print( MAX31865_fault );
+			serial_out.print(F(" safety "));
+			serial_out.println( safety.get_fault() );
+			return;
 		
-		/**************111 First Row 111*****************/
-		lcd.setCursor(0, 0);
-		lcd.print("Temp ");
-		
-		if ( temp_barier < 100 ) {
-			lcd.setCursor(5, 0);
-			lcd.print(" ");
-			lcd.setCursor(6, 0);
-		} else {
-			lcd.setCursor(5, 0);
-		}
-		lcd.print(temp_barier);    // print temperature barier
-	  
-		if ( mode.is_temp_barier_setting() ) {
-			lcd_symbols::set(8, 0);
-		} else {
-			lcd.setCursor(8, 0);
-			lcd.print(" ");
-		}
-
-		if ( current_temp < 100) {
-			lcd.setCursor(10, 0);
-			lcd.print(" ");
-			lcd.setCursor(11, 0);
-		} else {
-			lcd.setCursor(10, 0);
-		}
-		lcd.print(current_temp);   // print current temperature
-		lcd.setCursor(13, 0);
-		lcd.print("\337");
-		lcd.setCursor(14, 0);
-		lcd.print("C");
+		case COMMAND_GET:
+			if ( count != 2 || param == MODE_PARAM_COUNT ) {
+				break;
+			}
+			serial_out.print(F("ok "));
+			serial_out.println( mode.get_parameter(param) );
+			return;
 		
-		/**************222 Second Row 222*****************/
-		lcd.setCursor(0, 1);
-		lcd.print("Time ");
+		case COMMAND_SET:
+			if ( count != 3 || param == MODE_PARAM_COUNT || !commands.get_number(2, value) ) {
+				break;
+			}
+			if ( mode.get_current_mode() != 0 ) {
+				serial_out.println(F("err mode"));
+			} else if ( !mode.set_parameter(param, value) ) {
+				serial_out.println(F("err range"));
+			} else {
+				if ( param >= MODE_PARAM_KP ) {
+					flow.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+					zones.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+				}
+				serial_out.println(F("ok"));
+			}
+			return;
 		
-		if ( time_barier < 100 ) {
-			lcd.setCursor(5, 1);
-			lcd.print(" ");
-			lcd.setCursor(6, 1);
-		} else {
-			lcd.setCursor(5, 1);
-		}
-		lcd.print(time_barier);    // print time barier
-	  
-		if ( mode.is_time_barier_setting() ) {
-			lcd_symbols::set(8, 1);
-		} else {
-			lcd.setCursor(8, 1);
-			lcd.print(" ");
+		case COMMAND_START:
+		case COMMAND_ABORT:
+		case COMMAND_ACK: {
+			if ( count != 1 ) {
+				break;
+			}
+			byte request = command == COMMAND_START ? MODE_REQUEST_START : command == COMMAND_ABORT ? MODE_REQUEST_ABORT : MODE_REQUEST_ACK;
+			if ( mode.request(request) ) {
+				serial_out.println(F("ok"));
+			} else {
+				serial_out.println(F("err mode"));
+			}
+			return;
 		}
-		///////////////////////////////////////////////////////////////// second row
 		
+		case COMMAND_TELEMETRY:
+			if ( count != 2 || on == 2 ) {
+				break;
+			}
+			telemetry_enabled = on;
+			serial_out.println(F("ok"));
+			return;
 		
-		if ( flow.get_heat_relay_state() ) {
-			lcd_symbols::heat(15, 0);   // print heat symbol
-		} else {
-			lcd.setCursor(15, 0);
-			lcd.print(" ");             // clear heat symbol
-		}
+		case COMMAND_HISTORY:
+			if ( count != 1 ) {
+				break;
+			}
+			serial_out.println(F("ok"));
+			history.start_dump();
+			cycles.start_dump();
+			return;
 		
-		if ( flow.get_vent_relay_state() ) {
-			lcd_symbols::vent(15, 1);   // print vent symbol
-		} else {
-			lcd.setCursor(15, 1);
-			lcd.print(" ");             // clear vent symbol
-		}
+		case COMMAND_FILTER:
+			if ( count != 1 ) {
+				break;
+			}
+			serial_out.print(F("ok "));
+			serial_out.println( (uint32_t)zones.group_delay() * MAX31865_AUTO_MS / FILTER_DELAY_ONE );
+			return;
 		
-		int elapsed_time = flow.get_elapsed_time();
+#if PROFILING
+		case COMMAND_PROFILE:
+			if ( count != 2 || on == 2 ) {
+				break;
+			}
+			profiler.set_report( on );
+			serial_out.println(F("ok"));
+			return;
+#endif
 		
-		if ( flow.is_timer_started() ) {
-			if ( elapsed_time < 10 ) {
-				lcd.setCursor(10, 1);
-				lcd.print("  ");
-				lcd.setCursor(12, 1);
-			} else if (elapsed_time < 100) {
-				lcd.setCursor(10, 1);
-				lcd.print(" ");
-				lcd.setCursor(11, 1);
+		case COMMAND_RECIPE: {
+			recipe program;
+			mode.get_recipe( program );
+			if ( !mode.has_recipe() ) {
+				program.count = 0;   // the barriers, no recipe stored
+			}
+			if ( count == 1 ) {
+				serial_out.print(F("ok "));
+				serial_out.println( program.count );
+				return;
+			}
+			bool clear = count == 2 && commands.find(1, clear_name, 1) == 0;
+			
+			// segment number from 1, target, rate, hold, flags
+			int32_t fields[5];
+			fields[4] = 0;
+			bool valid = clear || count == 2 || count == 5 || count == 6;
+			for ( byte i = 1; valid && !clear && i < count; ++i ) {
+				valid = commands.get_number(i, fields[i - 1]);
+			}
+			if ( !valid ) {
+				break;
+			}
+			
+			if ( count == 2 && !clear ) {
+				if ( fields[0] < 1 || fields[0] > program.count ) {
+					serial_out.println(F("err range"));
+					return;
+				}
+				const recipe_segment &segment = program.segments[fields[0] - 1];
+				serial_out.print(F("ok "));
+				serial_out.print( segment.target );
+				serial_out.print(' ');
+				serial_out.print( segment.rate );
+				serial_out.print(' ');
+				serial_out.print( segment.hold );
+				serial_out.print(' ');
+				serial_out.println( segment.flags );
+				return;
+			}
+			
+			if ( mode.get_current_mode() != 0 ) {
+				serial_out.println(F("err mode"));
+				return;
+			}
+			if ( clear ) {
+				program.count = 0;
+				mode.set_recipe( program );
+				serial_out.println(F("ok"));
+				return;
+			}
+			bool in_range = fields[0] >= 1 && fields[0] <= RECIPE_MAX_SEGMENTS;
+			for ( byte i = 1; i < 5; ++i ) {
+				in_range = in_range && fields[i] >= 0 && fields[i] <= 255;
+			}
+			recipe_segment segment;
+			segment.target = fields[1];
+			segment.rate = fields[2];
+			segment.hold = fields[3];
+			segment.flags = fields[4];
+			// set_recipe_segment() holds the target to the range of the temperature barrier, the hold to the time range
+			if ( !in_range || !mode.set_recipe_segment(fields[0] - 1, segment) ) {
+				serial_out.println(F("err range"));
 			} else {
-				lcd.setCursor(10, 1);
+				serial_out.println(F("ok"));
 			}
-			lcd.print(elapsed_time);    // print sterilization time in minutes
-			lcd.setCursor(13, 1);
-			lcd.print("m");
+			return;
 		}
 		
-		static unsigned long int FinishTimeDelta;
-		static bool finish_biiset;
-		
-		if ( flow.is_operation_finished() ) {
-			lcd.setCursor(10, 1);
-			lcd.print(" END");
-			buzzer.finish();
+		default:
+			serial_out.println(F("err unknown"));
+			return;
+	}
+	serial_out.println(F("err syntax"));
+}
 
-			finish_biiset = 1;
-			FinishTimeDelta = millis();
 
-			mode.set_current_mode(0);   // All done, back to default mode
+void task_serial()
+{
+	// a command is taken only when its reply fits the transmit ring, it is never dropped
+	if ( serial_out.availableForWrite() >= SERIAL_REPLY_MAX ) {
+		byte line = commands.poll(Serial);
+		if ( line != COMMAND_NONE ) {
+			execute_command( line );
 		}
+	}
+	
+	if ( !history.dump(serial_out) ) {
+		cycles.dump(serial_out);
+	}
+#if PROFILING
+	profiler.report(serial_out);
+#endif
+	serial_out.pump();
+}
+
+
+void task_eeprom()
+{
+	mode.eeprom_service();   // parameter journal, written in the background
+	cycles.service();        // cycle summaries, the byte waits while the journal writes
+}
+
+
+void task_display()
+{
+	PROFILE_STAGE(profiler, STAGE_DISPLAY);
+	
+	byte temp_barier = mode.get_temp_barier();
+	byte time_barier = mode.get_time_barier();
+	int current_temp = current_temp_centi / 100;
+	
+	// a stored recipe shows the target and hold of its active segment in place of the barriers
+	bool show_segment = mode.has_recipe() && mode.get_current_mode() != 1;
+	byte segment = mode.get_current_mode() == 2 ? flow.get_segment() : 0;
+	if ( show_segment ) {
+		recipe program;
+		mode.get_recipe( program );
+		temp_barier = program.segments[segment].target;
+		time_barier = program.segments[segment].hold;
+	}
+	
+	if ( !MAX31865_fault && mode.get_current_mode() != 3 ) {
+		
+		int32_t values[MAIN_SLOTS];
+		byte blink = lcd_symbols::phase();
+		
+		values[SLOT_SEGMENT] = show_segment ? segment + 1 : SCREEN_HIDE;
+		values[SLOT_TEMP_LABEL] = show_segment ? SCREEN_HIDE : 0;
+		values[SLOT_TEMP_BARIER] = temp_barier;
+		values[SLOT_TEMP_SET] = mode.is_temp_barier_setting() ? blink : SCREEN_HIDE;
+		values[SLOT_TEMP] = current_temp;
+		values[SLOT_HEAT] = flow.get_heat_relay_state() ? blink : SCREEN_HIDE;
+		values[SLOT_TIME_BARIER] = time_barier;
+		values[SLOT_TIME_SET] = mode.is_time_barier_setting() ? blink : SCREEN_HIDE;
+		values[SLOT_ELAPSED] = flow.is_timer_started() ? flow.get_elapsed_time() : SCREEN_HIDE;
+		values[SLOT_AUTOTUNE] = mode.get_current_mode() == 4 ? flow.get_autotune().get_cycles() : SCREEN_HIDE;
+		values[SLOT_VENT] = flow.get_vent_relay_state() ? blink : SCREEN_HIDE;
 		
+		// "END" for a minute after a finished operation
 		if ( finish_biiset && (millis() - FinishTimeDelta > 60000) ) {
-			lcd.setCursor(10, 1);
-			lcd.print("    ");          // clear "FINISH" sign
 			finish_biiset = 0;
 		}
+		values[SLOT_END] = finish_biiset && !flow.is_timer_started() ? 0 : SCREEN_HIDE;
 		
-	} else {
+		screen_render( lcd_fb, main_screen, sizeof(main_screen) / sizeof(main_screen[0]), values );
 		
-		uint16_t rtd = max31865.readRTD();
-		float ratio = rtd;
-		ratio /= 32768;		
-		float rtd_resistance = RREF * ratio;
+	} else {
 		
-		int rtd_temperatureerature = int( max31865.temperature(100, RREF) );
+		int32_t values[FAULT_SLOTS];
+		values[SLOT_RTD_OHMS] = ((uint32_t)rtd_code * RREF_CENTI_OHM) >> 15;
+		values[SLOT_RTD_TEMP] = rtd::to_centi_degrees(rtd_code) / 100;
+		values[SLOT_FAULT] = safety.get_fault() && !MAX31865_fault ? SCREEN_HIDE : MAX31865_fault;
+		values[SLOT_SAFETY] = values[SLOT_FAULT] == SCREEN_HIDE ? safety.get_fault() : SCREEN_HIDE;
 		
-		print_fault( rtd_resistance, rtd_temperatureerature, MAX31865_fault );
+		screen_render( lcd_fb, fault_screen, sizeof(fault_screen) / sizeof(fault_screen[0]), values );
 		
 	}
 	
+	// send the changed cells to the display
+	PROFILE_STAGE(profiler, STAGE_LCD);
+	lcd_fb.flush();
+}
+
+/*********************************** TASKS ************************************/
+
+
+
+
+void setup()
+{  
+	lcd.init();                     
+	lcd.backlight();
+	lcd.setCursor(1, 0);
+	lcd.print(F("GYUMRI MEDICAL"));
+	lcd.setCursor(5, 1);
+	lcd.print(F("CENTER"));
+	delay(3000);
+	lcd.clear();
+	
+	lcd_symbols::create();
+	lcd_fb.init();
+	
+	max31865.begin(MAX31865_3WIRE);
+	Serial.begin(SERIAL_BAUD);
 	
+	// initialize buttons pins
+	buttons.init();
+	
+	// intitialize default mode
+	mode.init();
+	cycles.init();
+	//mode.set_temp_barier(111);
+	//mode.set_time_barier(111);
+	
+	// intitialize flow control parameters and relay pins, starts the heater timer
+	flow.init();
+	flow.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+	
+	// initialize the zones, the followers share the PID gains
+	zones.init();
+	zones.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+	
+	// initialize buzzer pin
+	buzzer.init();
+	
+	// register tasks in priority order
+	scheduler.add( task_sensor,    TASK_SENSOR_MS );
+	scheduler.add( task_control,   TASK_CONTROL_MS );
+	scheduler.add( task_buttons,   TASK_BUTTONS_MS );
+	scheduler.add( task_buzzer,    TASK_ON_DEMAND );
+	scheduler.add( task_telemetry, TASK_TELEMETRY_MS );
+	scheduler.add( task_serial,    TASK_SERIAL_MS );
+	scheduler.add( task_eeprom,    TASK_EEPROM_MS );
+	scheduler.add( task_display,   TASK_DISPLAY_MS );
+	
+	// plausibility checks of the chamber, the watchdog runs from here on
+	safety.set_model( 0, &flow.get_model() );
+	safety.init();
+	
+	// button pin change interrupt for the low-power idle
+	idle.init();
+}
+
+
+// Task rates of the low-power idle, the buttons wait for a pin change.
+// The heaters are off in the modes that idle, Timer1 and its 100 wake-ups
+// a second stop until a button or a mode change ends the idle.
+void set_idle_rates( bool idling )
+{
+	if ( idling ) {
+		heater_timer_stop();
+	} else {
+		heater_timer_init();
+	}
+	scheduler.set_period( TASK_SENSOR,    idling ? IDLE_TASK_MS : TASK_SENSOR_MS );
+	scheduler.set_period( TASK_CONTROL,   idling ? IDLE_TASK_MS : TASK_CONTROL_MS );
+	scheduler.set_period( TASK_BUTTONS,   idling ? TASK_ON_DEMAND : TASK_BUTTONS_MS );
+	scheduler.set_period( TASK_TELEMETRY, idling ? IDLE_TASK_MS : TASK_TELEMETRY_MS );
+	scheduler.set_period( TASK_DISPLAY,   idling ? IDLE_TASK_MS : TASK_DISPLAY_MS );
+}
+
+
+void loop()
+{
+	PROFILE_STAGE(profiler, STAGE_LOOP);
+	safety.kick();
+	
+	byte current_mode = mode.get_current_mode();
+	byte change = idle.update( (current_mode == 0 || current_mode == 1) && !buttons.get_state() );
+	if ( change != IDLE_NONE ) {
+		set_idle_rates( change == IDLE_ENTER );
+	}
+	
+	if ( !scheduler.run() && idle.is_idle() ) {
+		idle.sleep();
+	}
 }
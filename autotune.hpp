@@ -0,0 +1,255 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+#include "hal.hpp"
+#include "pid_control.hpp"
+
+// Relay feedback autotune (Astrom-Hagglund).
+// The heater is switched fully on below setpoint - hysteresis and off above
+// setpoint + hysteresis, the oven settles into a limit cycle whose amplitude a
+// and period Tu give the ultimate gain Ku = 4 d / (pi sqrt(a^2 - hysteresis^2)),
+// d = half the relay swing. The PID gains follow from the Ziegler-Nichols rules
+// (Kp = 0.6 Ku, Ti = Tu / 2, Td = Tu / 8). Derivative on measurement and the
+// conditional integration of pid_control keep the overshoot of these gains low,
+// the more conservative Tyreus-Luyben set leaves the oven far too slow to settle.
+
+#define AUTOTUNE_HYSTERESIS   50          // centi-degrees
+#define AUTOTUNE_SKIP_CYCLES  1           // heat-up transient, not measured
+#define AUTOTUNE_CYCLES       3           // averaged cycles
+#define AUTOTUNE_TIMEOUT_MS   10800000UL  // gives up after 3 hours
+
+// Ku = 4 d / (pi a) with 2 d = AUTOTUNE_RELAY_SWING: Ku in Q16 duty counts per centi-degree is this / a,
+// 4 d / pi * 2^16 rounded, in integer math so the AVR and the host fold it alike
+#define AUTOTUNE_RELAY_SWING   255            // duty counts between relay off and on
+#define AUTOTUNE_PI_E8         314159265ULL   // pi * 10^8
+#define AUTOTUNE_KU_NUMERATOR  ((uint32_t)((2ULL * AUTOTUNE_RELAY_SWING * Q16_ONE * 100000000ULL + AUTOTUNE_PI_E8 / 2) / AUTOTUNE_PI_E8))
+
+
+class relay_autotune
+{
+	public:
+		relay_autotune();
+
+		void start( int32_t setpoint );                // setpoint in centi-degrees
+		void stop();
+
+		// One step, returns the heater relay state
+		bool update( int32_t measurement );
+
+		bool is_idle() const;                          // not started since the last stop()
+		bool is_running() const;
+		bool is_finished() const;                      // gains are ready
+		bool is_failed() const;                        // no stable limit cycle before the timeout
+		byte get_cycles() const;                       // measured cycles so far
+
+		int32_t get_ku() const;                        // ultimate gain, Q16 duty counts per centi-degree
+		uint32_t get_tu() const;                       // ultimate period, ms
+
+		int32_t get_kp() const;                        // PID gains, units as in pid_control
+		int32_t get_ki() const;
+		int32_t get_kd() const;
+
+	private:
+		void finish();
+		static uint16_t isqrt( uint32_t value );
+
+	protected:
+		enum { IDLE, RUNNING, FINISHED, FAILED };
+		byte state;
+
+		int32_t setpoint;
+		bool heating;                  // relay output
+		byte switch_offs;              // relay on -> off switches so far
+
+		uint32_t start_time;
+		uint32_t last_off_time;        // start of the current cycle
+		int32_t peak;                  // highest temperature after the last switch-off
+		int32_t trough;                // lowest temperature after the last switch-on
+
+		uint32_t period_sum;           // ms
+		uint32_t amplitude_sum;        // peak to peak, centi-degrees
+		byte cycles;
+
+		int32_t ku;
+		uint32_t tu;
+};
+
+
+relay_autotune::relay_autotune()
+			  : state(IDLE), ku(0), tu(0)
+{
+
+}
+
+
+void relay_autotune::start( int32_t sp )
+{
+	state = RUNNING;
+	setpoint = sp;
+	heating = true;
+	switch_offs = 0;
+	start_time = hal::millis();
+	last_off_time = start_time;
+	peak = sp;
+	trough = sp;
+	period_sum = 0;
+	amplitude_sum = 0;
+	cycles = 0;
+}
+
+
+void relay_autotune::stop()
+{
+	state = IDLE;
+}
+
+
+bool relay_autotune::update( int32_t measurement )
+{
+	if ( state != RUNNING ) {
+		return false;
+	}
+
+	uint32_t now = hal::millis();
+	if ( now - start_time > AUTOTUNE_TIMEOUT_MS ) {
+		state = FAILED;
+		return false;
+	}
+
+	if ( heating ) {
+		if ( measurement < trough ) {
+			trough = measurement;
+		}
+		if ( measurement > setpoint + AUTOTUNE_HYSTERESIS ) {
+			heating = false;
+
+			// a cycle is complete at every switch-off after the first one
+			if ( switch_offs > AUTOTUNE_SKIP_CYCLES ) {
+				period_sum += now - last_off_time;
+				amplitude_sum += peak - trough;
+				if ( ++cycles == AUTOTUNE_CYCLES ) {
+					finish();
+					return false;
+				}
+			}
+			++switch_offs;
+			last_off_time = now;
+			peak = measurement;
+		}
+	} else {
+		if ( measurement > peak ) {
+			peak = measurement;
+		}
+		if ( measurement < setpoint - AUTOTUNE_HYSTERESIS ) {
+			heating = true;
+			trough = measurement;
+		}
+	}
+
+	return heating;
+}
+
+
+void relay_autotune::finish()
+{
+	tu = period_sum / cycles;
+
+	// amplitude of the limit cycle, corrected for the relay hysteresis
+	uint32_t amplitude = amplitude_sum / (2 * cycles);
+	uint32_t hysteresis = AUTOTUNE_HYSTERESIS;
+	uint16_t effective = amplitude > hysteresis ? isqrt(amplitude * amplitude - hysteresis * hysteresis) : 0;
+
+	if ( effective == 0 || tu == 0 ) {
+		state = FAILED;
+		return;
+	}
+
+	ku = AUTOTUNE_KU_NUMERATOR / effective;
+	state = FINISHED;
+}
+
+
+bool relay_autotune::is_idle() const
+{
+	return state == IDLE;
+}
+
+
+bool relay_autotune::is_running() const
+{
+	return state == RUNNING;
+}
+
+
+bool relay_autotune::is_finished() const
+{
+	return state == FINISHED;
+}
+
+
+bool relay_autotune::is_failed() const
+{
+	return state == FAILED;
+}
+
+
+byte relay_autotune::get_cycles() const
+{
+	return cycles;
+}
+
+
+int32_t relay_autotune::get_ku() const
+{
+	return ku;
+}
+
+
+uint32_t relay_autotune::get_tu() const
+{
+	return tu;
+}
+
+
+int32_t relay_autotune::get_kp() const
+{
+	return ku * 6 / 10;
+}
+
+
+int32_t relay_autotune::get_ki() const
+{
+	// Ki = Kp * Ts / Ti per PID sample
+	return (int64_t)get_kp() * PID_SAMPLE_MS * 2 / tu;
+}
+
+
+int32_t relay_autotune::get_kd() const
+{
+	// Kd = Kp * Td / Ts per PID sample
+	return (int64_t)get_kp() * tu / (8 * PID_SAMPLE_MS);
+}
+
+
+uint16_t relay_autotune::isqrt( uint32_t value )
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while ( bit > value ) {
+		bit >>= 2;
+	}
+	while ( bit ) {
+		if ( value >= root + bit ) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return root;
+}
+
+
+#endif // AUTOTUNE_HPP
@@ -0,0 +1,239 @@
+#ifndef BUTTON_BANK_HPP
+#define BUTTON_BANK_HPP
+
+#include "hal.hpp"
+#include "gpio.hpp"
+
+// All four buttons sit on consecutive pins of one port (D8...D13 are PINB bits 0...5,
+// A0...A5 PINC bits 0...5), so one read of the port register samples all of them at once.
+// Debouncing runs on the whole byte in parallel with 2-bit vertical counters:
+// bit n of cnt0/cnt1 is the counter of button n, a button changes its debounced
+// state after BUTTON_DEBOUNCE_TICKS equal samples that differ from it.
+// Events are returned as bitmasks of BUTTON::PLUS/MINUS/SELECT/START.
+// A button held past the long press repeats every BUTTON_REPEAT_TICKS, past
+// the secret press every BUTTON_REPEAT_FAST_TICKS, independent of the tick rate.
+
+#define BUTTON_COUNT           4
+#define BUTTON_TICK_MS         5                           // handle() period
+#define BUTTON_DEBOUNCE_TICKS  4                           // 20 ms, fixed by the 2-bit counters
+#define DEF_LONGPRESS_TICKS    (1000 / BUTTON_TICK_MS)     // the long press time
+#define DEF_SECRETPRESS_TICKS  (3000 / BUTTON_TICK_MS)     // the secret press time
+#define BUTTON_REPEAT_TICKS    (150 / BUTTON_TICK_MS)      // autorepeat step after the long press
+#define BUTTON_REPEAT_FAST_TICKS  (50 / BUTTON_TICK_MS)    // and after the secret press
+
+namespace EVENT {
+	enum { 
+	  NONE        = 0,   // or binary 0b000
+	  SHORTPRESS  = 1,   // or binary 0b001
+	  LONGPRESS   = 2,   // or binary 0b010
+	  SECRETPRESS = 4    // or binary 0b100
+	};
+}
+
+// button bits, in the order of the pins starting at first_pin
+namespace BUTTON {
+	enum {
+	  PLUS   = 1,
+	  MINUS  = 2,
+	  SELECT = 4,
+	  START  = 8
+	};
+}
+
+
+
+// FIRST_PIN is the pin of BUTTON::PLUS, the other buttons follow it on the same port
+template <byte FIRST_PIN>
+class button_bank
+{
+	public:
+		// Constructor
+		button_bank( uint16_t long_press_ticks = DEF_LONGPRESS_TICKS, uint16_t secret_press_ticks = DEF_SECRETPRESS_TICKS );
+
+		// Initialization done after construction, to permit static instances
+		void init();
+
+		// Handler, to be called every BUTTON_TICK_MS
+		void handle();
+
+		byte get_state() const;              // debounced pressed buttons
+
+		// buttons with the event in the last handle() call
+		byte get_shortpress() const;
+		byte get_longpress() const;
+		byte get_secretpress() const;
+		byte get_repeat() const;             // autorepeat steps of the held buttons
+
+		// buttons whose last event is long/secret press and are still held
+		byte get_last_longpress() const;
+		byte get_last_secretpress() const;
+
+	protected:
+		static const byte shift = gpio_pin<FIRST_PIN>::bit;   // bit of the first button in the port
+
+		const uint16_t long_press_ticks;     // the long press time
+		const uint16_t secret_press_ticks;   // the secret press time
+
+		byte state;                          // debounced state, 1 = pressed
+		byte cnt0;                           // vertical counter, low bits
+		byte cnt1;                           // vertical counter, high bits
+
+		byte shortpress;                     // events of this tick
+		byte longpress;
+		byte secretpress;
+		byte repeat;
+
+		byte last_longpress;                 // last events of the held buttons
+		byte last_secretpress;
+
+		uint16_t held_ticks[BUTTON_COUNT];   // press duration, saturates at secret_press_ticks
+		byte repeat_ticks[BUTTON_COUNT];     // since the last autorepeat step
+};
+
+
+
+template <byte FIRST_PIN>
+button_bank<FIRST_PIN>::button_bank( uint16_t lp, uint16_t sp )
+		   : long_press_ticks(lp), secret_press_ticks(sp)
+{
+
+}
+
+
+template <byte FIRST_PIN>
+void button_bank<FIRST_PIN>::init()
+{
+	// internal pull-up 20k resistor, pushbutton's logic is inverted
+	gpio_pin<FIRST_PIN>::set_input_pullup();
+	gpio_pin<FIRST_PIN + 1>::set_input_pullup();
+	gpio_pin<FIRST_PIN + 2>::set_input_pullup();
+	gpio_pin<FIRST_PIN + 3>::set_input_pullup();
+
+	for ( byte i = 0; i < BUTTON_COUNT; ++i ) {
+		held_ticks[i] = 0;
+		repeat_ticks[i] = 0;
+	}
+	state = 0;
+	cnt0 = 0xFF;
+	cnt1 = 0xFF;
+	shortpress = 0;
+	longpress = 0;
+	secretpress = 0;
+	repeat = 0;
+	last_longpress = 0;
+	last_secretpress = 0;
+}
+
+
+template <byte FIRST_PIN>
+void button_bank<FIRST_PIN>::handle()
+{
+	const byte mask = (1 << BUTTON_COUNT) - 1;
+
+	// 1 = pressed, the pins are pulled up
+	byte sample = (~gpio_pin<FIRST_PIN>::read_port() >> shift) & mask;
+
+	// count the ticks each button differs from its debounced state,
+	// counters of unchanged buttons are reset
+	byte changed = sample ^ state;
+	cnt0 = ~(cnt0 & changed);
+	cnt1 = cnt0 ^ (cnt1 & changed);
+	changed &= cnt0 & cnt1 & mask;      // counter rolled over
+	state ^= changed;
+
+	byte pressed = changed & state;
+	byte released = changed & ~state;
+
+	shortpress = pressed;
+	longpress = 0;
+	secretpress = 0;
+	repeat = 0;
+	last_longpress &= ~released;
+	last_secretpress &= ~released;
+
+	if ( !state ) {
+		return;
+	}
+
+	for ( byte i = 0; i < BUTTON_COUNT; ++i ) {
+		byte button = 1 << i;
+		if ( !(state & button) ) {
+			continue;
+		}
+		if ( pressed & button ) {
+			held_ticks[i] = 0;
+			continue;
+		}
+		if ( held_ticks[i] < secret_press_ticks ) {
+			++held_ticks[i];
+			// each event registered only once per press
+			if ( held_ticks[i] == long_press_ticks ) {
+				longpress |= button;
+				last_longpress |= button;
+				repeat_ticks[i] = 0;
+				continue;
+			} else if ( held_ticks[i] == secret_press_ticks ) {
+				secretpress |= button;
+				last_secretpress |= button;
+				last_longpress &= ~button;
+			}
+		}
+		if ( held_ticks[i] > long_press_ticks &&
+			 ++repeat_ticks[i] >= (held_ticks[i] < secret_press_ticks ? BUTTON_REPEAT_TICKS : BUTTON_REPEAT_FAST_TICKS) ) {
+			repeat_ticks[i] = 0;
+			repeat |= button;
+		}
+	}
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_state() const
+{
+	return state;
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_shortpress() const
+{
+	return shortpress;
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_longpress() const
+{
+	return longpress;
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_secretpress() const
+{
+	return secretpress;
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_repeat() const
+{
+	return repeat;
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_last_longpress() const
+{
+	return last_longpress;
+}
+
+
+template <byte FIRST_PIN>
+byte button_bank<FIRST_PIN>::get_last_secretpress() const
+{
+	return last_secretpress;
+}
+
+
+#endif // BUTTON_BANK_HPP
@@ -1,75 +1,93 @@
 #ifndef BUZZER_HPP
 #define BUZZER_HPP
 
+#include "hal.hpp"
+#include "gpio.hpp"
 
+
+// PIN: gpio_pin<> type of the buzzer
+template <class PIN>
 class buzzer_control
 {
 	public:
-		buzzer_control( byte pin );
+		buzzer_control();
 		void init();
-		void buttons( const byte &event_button_plus, const byte &event_button_minus, const byte &event_button_select, const byte &event_button_start );
+		void buttons( byte shortpress, byte longpress, byte secretpress );
 		void finish();
 		
+		bool is_pending() const;   // true if a tone is requested and not played yet
+		void service();            // play the requested tone, to be called from the buzzer task
+		
+	private:
+		void request( unsigned int frequency, unsigned int duration );
+		
 	protected:
-		const byte pin;
+		unsigned int pending_frequency;   // 0 if nothing to play
+		unsigned int pending_duration;
 };
 
 
-buzzer_control::buzzer_control( byte p )
-			   : pin(p)
+template <class PIN>
+buzzer_control<PIN>::buzzer_control()
 {
 
 }			   
 
 
-void buzzer_control::init()
+template <class PIN>
+void buzzer_control<PIN>::init()
 {
 	// initialize buzzer pin
-	pinMode(pin, OUTPUT);
+	PIN::set_output();
+	pending_frequency = 0;
+	pending_duration = 0;
+}
+
+
+// arguments are bitmasks of the buttons with the event, 0 if none
+template <class PIN>
+inline void buzzer_control<PIN>::buttons( byte shortpress, byte longpress, byte secretpress )
+{
+	if ( shortpress ) {
+		request(500, 200);
+	} else if ( longpress ) {
+		request(700, 400);
+	} else if ( secretpress ) {
+		request(800, 500);
+	}
+}
+
+
+template <class PIN>
+void buzzer_control<PIN>::finish()
+{
+	request(700, 5000);
+}
+
+
+template <class PIN>
+bool buzzer_control<PIN>::is_pending() const
+{
+	return pending_frequency != 0;
 }
 
 
-inline void buzzer_control::buttons( const byte &event_button_plus, const byte &event_button_minus, const byte &event_button_select, const byte &event_button_start )
+template <class PIN>
+void buzzer_control<PIN>::service()
 {
-	
-	byte button_short_pressed = 0;
-	button_short_pressed |= event_button_plus;
-	button_short_pressed |= event_button_minus;
-	button_short_pressed |= event_button_select;
-	button_short_pressed |= event_button_start;
-	button_short_pressed &= 1;
-	
-	byte button_long_pressed = 0;
-	button_long_pressed |= event_button_plus;
-	button_long_pressed |= event_button_minus;
-	button_long_pressed |= event_button_select;
-	button_long_pressed |= event_button_start;
-	button_long_pressed &=  2;
-			
-	byte button_secret_pressed = 0;
-	//button_secret_pressed |= event_button_plus;
-	//button_secret_pressed |= event_button_minus;
-	//button_secret_pressed |= event_button_select;
-	button_secret_pressed |= event_button_start;
-	button_secret_pressed &=  4;
-	
-	if ( button_short_pressed == 1 ) {
-		tone(pin, 500, 200);
-	} else if ( button_long_pressed == 2 ) {
-		tone(pin, 700, 400);
-	} else if ( button_secret_pressed == 4 ) {
-		tone(pin, 800, 500);
-	} else {
-		//noTone(8);
-	}	
-	
+	if ( pending_frequency ) {
+		hal::tone(PIN::number, pending_frequency, pending_duration);
+		pending_frequency = 0;
+	}
 }
 
 
-void buzzer_control::finish()
+template <class PIN>
+void buzzer_control<PIN>::request( unsigned int frequency, unsigned int duration )
 {
-	tone(pin, 700, 5000);
+	pending_frequency = frequency;
+	pending_duration = duration;
 }
 
 
-#endif // BUZZER_HPP
+#endif // BUZZER_HPP
@@ -0,0 +1,60 @@
+#ifndef COBS_HPP
+#define COBS_HPP
+
+#include "hal.hpp"
+
+// Consistent Overhead Byte Stuffing. The encoded data contains no 0x00 bytes,
+// so 0x00 can delimit frames on a byte stream. Encoded length is at most
+// length + length / 254 + 1.
+
+#define COBS_MAX_ENCODED(length)  ((length) + (length) / 254 + 1)
+
+
+// Returns the encoded length
+inline byte cobs_encode( const byte *in, byte length, byte *out )
+{
+	byte code_pos = 0;     // where the length code of the current block goes
+	byte code = 1;
+	byte out_pos = 1;
+
+	for ( byte i = 0; i < length; ++i ) {
+		if ( in[i] ) {
+			out[out_pos++] = in[i];
+			++code;
+		}
+		if ( !in[i] || code == 0xFF ) {
+			out[code_pos] = code;
+			code_pos = out_pos++;
+			code = 1;
+		}
+	}
+	out[code_pos] = code;
+
+	return out_pos;
+}
+
+
+// Returns the decoded length, 0 if the input is not valid COBS
+inline byte cobs_decode( const byte *in, byte length, byte *out )
+{
+	byte in_pos = 0;
+	byte out_pos = 0;
+
+	while ( in_pos < length ) {
+		byte code = in[in_pos++];
+		if ( code == 0 || in_pos + code - 1 > length ) {
+			return 0;
+		}
+		for ( byte i = 1; i < code; ++i ) {
+			out[out_pos++] = in[in_pos++];
+		}
+		if ( code != 0xFF && in_pos < length ) {
+			out[out_pos++] = 0;
+		}
+	}
+
+	return out_pos;
+}
+
+
+#endif // COBS_HPP
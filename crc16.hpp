@@ -0,0 +1,31 @@
+#ifndef CRC16_HPP
+#define CRC16_HPP
+
+#include "hal.hpp"
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF, no reflection.
+// Bitwise, no table, to keep it out of flash and RAM.
+
+#define CRC16_INIT  0xFFFF
+
+
+inline uint16_t crc16_update( uint16_t crc, byte data )
+{
+	crc ^= (uint16_t)data << 8;
+	for ( byte i = 0; i < 8; ++i ) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+
+inline uint16_t crc16( const byte *data, byte length, uint16_t crc = CRC16_INIT )
+{
+	while ( length-- ) {
+		crc = crc16_update(crc, *data++);
+	}
+	return crc;
+}
+
+
+#endif // CRC16_HPP
@@ -0,0 +1,232 @@
+#ifndef CYCLE_LOG_HPP
+#define CYCLE_LOG_HPP
+
+#include "hal.hpp"
+#include "crc16.hpp"
+#include "param_journal.hpp"   // PARAM_JOURNAL_END
+#include "run_history.hpp"     // cycle_summary
+
+// Summaries of the last CYCLE_LOG_SLOTS cycles in EEPROM, after the parameter
+// journal. A ring of slots like the journal: the newest is found at startup by
+// its sequence number, a summary is written in the background one byte per
+// service() call and its CRC comes last, so a slot cut short by a power loss
+// is skipped.
+//
+// Slot, little-endian:
+//   0  u8   record version (CYCLE_LOG_VERSION)
+//   1  u16  sequence number
+//   3  u8   result (HISTORY_FINISHED, HISTORY_ABORTED, HISTORY_FAULT)
+//   4  u8   highest target, C
+//   5  u8   hold, minutes
+//   6  u8   start temperature, C
+//   7  u8   mean heater duty, percent
+//   8  i16  peak temperature, centi-degrees
+//  10  u16  s to the first arrival at a target, 0xFFFF if never
+//  12  u16  duration, s
+//  14  u16  CRC-16 of bytes 0...13
+
+#define CYCLE_LOG_VERSION    1
+#define CYCLE_LOG_ADDR       PARAM_JOURNAL_END
+#define CYCLE_LOG_SLOT_SIZE  16
+#define CYCLE_LOG_SLOTS      8
+#define CYCLE_LOG_END        (CYCLE_LOG_ADDR + CYCLE_LOG_SLOT_SIZE * CYCLE_LOG_SLOTS)
+#define CYCLE_LOG_CRC_ADDR   (CYCLE_LOG_SLOT_SIZE - 2)
+
+#if CYCLE_LOG_END > 1024
+	#error "the cycle log does not fit the EEPROM of the ATmega328"
+#endif
+
+
+class cycle_log
+{
+	public:
+		cycle_log();
+
+		void init();                                        // finds the newest summary
+		void append( const cycle_summary &summary );        // queued, written by service()
+
+		void service();                                     // writes at most one byte, to be called in the loop()
+		bool is_busy() const;
+
+		// age 0 is the newest, false if the slot holds no valid summary
+		bool read( byte age, cycle_summary &summary ) const;
+
+#if defined(ARDUINO)
+		void start_dump();
+		bool dump( Print &out );                            // at most one line per call, false when done
+#endif
+
+	private:
+		bool read_slot( byte slot, byte *data ) const;
+		static int slot_addr( byte slot );
+
+	protected:
+		byte image[CYCLE_LOG_SLOT_SIZE];   // slot being written
+		byte write_pos;                    // next byte of image, CYCLE_LOG_SLOT_SIZE when idle
+		byte slot;                         // slot of the newest summary
+		uint16_t sequence;
+
+#if defined(ARDUINO)
+		byte dump_age;                     // next summary to print, CYCLE_LOG_SLOTS when idle
+#endif
+};
+
+
+cycle_log::cycle_log()
+		 : write_pos(CYCLE_LOG_SLOT_SIZE), slot(CYCLE_LOG_SLOTS - 1), sequence(0)
+{
+#if defined(ARDUINO)
+	dump_age = CYCLE_LOG_SLOTS;
+#endif
+}
+
+
+void cycle_log::init()
+{
+	bool found = false;
+	byte data[CYCLE_LOG_SLOT_SIZE];
+
+	for ( byte s = 0; s < CYCLE_LOG_SLOTS; ++s ) {
+		if ( !read_slot(s, data) ) {
+			continue;
+		}
+		// sequence numbers wrap, newer means ahead by less than half the range
+		uint16_t seq = data[1] | (uint16_t)data[2] << 8;
+		if ( found && (int16_t)(seq - sequence) <= 0 ) {
+			continue;
+		}
+		found = true;
+		slot = s;
+		sequence = seq;
+	}
+}
+
+
+void cycle_log::append( const cycle_summary &summary )
+{
+	// a summary still being written is replaced in its own slot
+	if ( !is_busy() ) {
+		slot = (slot + 1) % CYCLE_LOG_SLOTS;
+		++sequence;
+	}
+
+	image[0] = CYCLE_LOG_VERSION;
+	image[1] = sequence;
+	image[2] = sequence >> 8;
+	image[3] = summary.result;
+	image[4] = summary.target;
+	image[5] = summary.hold;
+	image[6] = summary.start_temp;
+	image[7] = summary.heater_percent;
+	image[8] = summary.peak_temp;
+	image[9] = (uint16_t)summary.peak_temp >> 8;
+	image[10] = summary.arrival;
+	image[11] = summary.arrival >> 8;
+	image[12] = summary.duration;
+	image[13] = summary.duration >> 8;
+
+	uint16_t crc = crc16(image, CYCLE_LOG_CRC_ADDR);
+	image[CYCLE_LOG_CRC_ADDR] = crc;
+	image[CYCLE_LOG_CRC_ADDR + 1] = crc >> 8;
+
+	write_pos = 0;
+}
+
+
+void cycle_log::service()
+{
+	if ( !is_busy() || !hal::eeprom_ready() ) {
+		return;
+	}
+	hal::eeprom_write(slot_addr(slot) + write_pos, image[write_pos]);
+	++write_pos;
+}
+
+
+bool cycle_log::is_busy() const
+{
+	return write_pos < CYCLE_LOG_SLOT_SIZE;
+}
+
+
+bool cycle_log::read( byte age, cycle_summary &summary ) const
+{
+	byte data[CYCLE_LOG_SLOT_SIZE];
+	if ( age >= CYCLE_LOG_SLOTS || !read_slot((slot + CYCLE_LOG_SLOTS - age) % CYCLE_LOG_SLOTS, data) ) {
+		return false;
+	}
+
+	summary.result = data[3];
+	summary.target = data[4];
+	summary.hold = data[5];
+	summary.start_temp = data[6];
+	summary.heater_percent = data[7];
+	summary.peak_temp = data[8] | (uint16_t)data[9] << 8;
+	summary.arrival = data[10] | (uint16_t)data[11] << 8;
+	summary.duration = data[12] | (uint16_t)data[13] << 8;
+	return true;
+}
+
+
+bool cycle_log::read_slot( byte s, byte *data ) const
+{
+	int addr = slot_addr(s);
+	for ( byte i = 0; i < CYCLE_LOG_SLOT_SIZE; ++i ) {
+		data[i] = hal::eeprom_read(addr + i);
+	}
+	uint16_t crc = data[CYCLE_LOG_CRC_ADDR] | (uint16_t)data[CYCLE_LOG_CRC_ADDR + 1] << 8;
+	return data[0] == CYCLE_LOG_VERSION && crc == crc16(data, CYCLE_LOG_CRC_ADDR);
+}
+
+
+int cycle_log::slot_addr( byte s )
+{
+	return CYCLE_LOG_ADDR + s * CYCLE_LOG_SLOT_SIZE;
+}
+
+
+#if defined(ARDUINO)
+void cycle_log::start_dump()
+{
+	dump_age = 0;
+}
+
+
+bool cycle_log::dump( Print &out )
+{
+	if ( dump_age >= CYCLE_LOG_SLOTS ) {
+		return false;
+	}
+	if ( out.availableForWrite() < 40 || is_busy() ) {
+		return true;
+	}
+
+	// one line per cycle, newest first: age result target hold start peak arrival duration heater%
+	cycle_summary summary;
+	if ( read(dump_age, summary) ) {
+		out.print(F("cycle "));
+		out.print(dump_age);
+		out.print(' ');
+		out.print(summary.result);
+		out.print(' ');
+		out.print(summary.target);
+		out.print(' ');
+		out.print(summary.hold);
+		out.print(' ');
+		out.print(summary.start_temp);
+		out.print(' ');
+		out.print(summary.peak_temp);
+		out.print(' ');
+		out.print(summary.arrival);
+		out.print(' ');
+		out.print(summary.duration);
+		out.print(' ');
+		out.println(summary.heater_percent);
+	}
+	++dump_age;
+	return dump_age < CYCLE_LOG_SLOTS;
+}
+#endif
+
+
+#endif // CYCLE_LOG_HPP
@@ -1,219 +1,476 @@
 #ifndef FLOW_CONTROL_HPP
 #define FLOW_CONTROL_HPP
 
+#include "hal.hpp"
+#include "gpio.hpp"
+#include "pid_control.hpp"
+#include "autotune.hpp"
+#include "thermal_model.hpp"
+#include "recipe.hpp"
+#include "heater_output.hpp"
+
+#define BOOST_MIN_ERROR  1000   // centi-degrees below the barier for a model driven heat-up
+#define COAST_BAND       20     // centi-degrees, the coast ends this close to the barier
+
+// model driven heat-up phases
+enum { HEATUP_PID, HEATUP_BOOST, HEATUP_COAST };
+
 
 const byte ON  = 1;
 const byte OFF = 0;
 
 
+// HEAT_PIN, VENT_PIN: gpio_pin<> types of the relays
+template <class HEAT_PIN, class VENT_PIN>
 class flow_control
 {
 	public:
-		flow_control( byte pin_relay_heat, byte pin_relay_vent );
+		flow_control();
 		
 		void init();
-		void control( byte current_mode, int current_temp, byte temp_barier, byte time_barier );
+		void control( byte current_mode, int current_temp, const recipe &program );   // current_temp in centi-degrees
+		
+		// Coldest and hottest of all zones that follow this chamber (zone_bank), centi-degrees,
+		// the hold of a segment starts only when all of them have arrived
+		void set_zone_span( int coldest_temp, int hottest_temp );
 
+		void heater_tick();                           // Timer1 interrupt, every HEATER_TICK_MS (heater_output)
+		void set_heat_window( uint16_t ms );          // time-proportioning window, HEAT_WINDOW_MS unless set
+		
 		bool get_heat_relay_state() const;
 		bool get_vent_relay_state() const;
 		
 		bool is_timer_started() const;
 		bool is_operation_finished() const;
 		
-		int get_elapsed_time() const;
+		int get_elapsed_time() const;                 // minutes of the hold of the active segment
+		byte get_heat_duty() const;
+		byte get_segment() const;                     // active recipe segment, from 0
+		int32_t get_setpoint() const;                 // ramp setpoint, centi-degrees
+		
+		void set_pid_gains( int32_t kp, int32_t ki, int32_t kd );
+		
+		const relay_autotune &get_autotune() const;   // results of the mode 4 experiment
+		const thermal_model &get_model() const;       // online oven model
+		byte get_heatup_phase() const;                // HEATUP_BOOST: full power until the predicted coast reaches
+		                                              // the barier, HEATUP_COAST: holding duty until it does
 		
 	private:  
-		void heat_relay(bool);
 		void vent_relay(bool);
-		void heating_power_control( float coefficient );
-		void middle_power_heating();
-		void low_power_heating();		
+		void model_control( byte current_mode, int current_temp );
+		void start_segment( const recipe &program, int current_temp );
+		int32_t ramp_setpoint( const recipe_segment &seg ) const;
 		
 	protected:
-		const byte pin_relay_heat;
-		const byte pin_relay_vent;
-		
-		bool heat_relay_state;
+		heater_output<HEAT_PIN> heater;
 		bool vent_relay_state;
 	
 		unsigned long int timer_start;
 		bool timer_bitset;
 		int elapsed_time;
 		bool operation_finished;
-		bool completed;
+		
+		pid_control pid;
+		byte heat_duty;                  // heater duty 0...255 from the PID
+		unsigned long int pid_sample_time;
+		
+		byte segment;                    // active recipe segment
+		unsigned long int segment_start;
+		int32_t ramp_from;               // setpoint at the segment start, centi-degrees
+		int32_t setpoint;                // centi-degrees
+		bool zone_span_set;
+		int zone_coldest;
+		int zone_hottest;
+		
+		relay_autotune autotune;
+		
+		thermal_model model;
+		byte last_mode;                  // mode of the previous call
+		byte heatup_phase;               // HEATUP_PID after the model driven heat-up
+		int coast_peak;                  // highest temperature while coasting
+		byte coast_duty;                 // duty that holds the barier
+		unsigned long int model_sample_time;
+		uint16_t model_on_count;         // heater on calls in this model step
+		uint16_t model_count;            // calls in this model step
+		bool dead_time_measured;
+		bool dead_time_measuring;
+		unsigned long int heatup_start;
+		int heatup_temp;
 };
 
 
-flow_control::flow_control( byte p_relay_heat, byte p_relay_vent )
-			 : pin_relay_heat(p_relay_heat), pin_relay_vent(p_relay_vent)
+template <class HEAT_PIN, class VENT_PIN>
+flow_control<HEAT_PIN, VENT_PIN>::flow_control()
 {
 	
 }
 
 
-void flow_control::init()
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::init()
 {
 	// initialize relays pins
-	pinMode(pin_relay_heat, OUTPUT);
-	pinMode(pin_relay_vent, OUTPUT);
+	heater.init();
+	VENT_PIN::set_output();
 	
-	heat_relay_state = false;
 	vent_relay_state = false;
 	
 	timer_start = 0;
 	timer_bitset = false;
 	elapsed_time = 0;   // sterilization time in minutes
 	operation_finished = false;
+	
+	pid.reset();
+	heat_duty = 0;
+	pid_sample_time = 0;
+	
+	segment = 0;
+	setpoint = 0;
+	zone_span_set = false;
+	
+	model.reset();
+	last_mode = 0;
+	heatup_phase = HEATUP_PID;
+	model_sample_time = 0;
+	model_on_count = 0;
+	model_count = 0;
+	dead_time_measured = false;
+	dead_time_measuring = false;
 }
 
 
-void flow_control::control( byte current_mode, int current_temp, byte temp_barier, byte time_barier )
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::control( byte current_mode, int current_temp, const recipe &program )
 {
+	if ( current_mode == 2 && last_mode != 2 ) {
+		// cycle start, the first heat-up measures the dead time
+		segment = 0;
+		this->start_segment( program, current_temp );
+		if ( !dead_time_measured && program.count && current_temp < (int32_t)program.segments[0].target * 100 - BOOST_MIN_ERROR ) {
+			dead_time_measuring = true;
+			heatup_start = hal::millis();
+			heatup_temp = current_temp;
+		}
+	}
+	
 	if ( current_mode == 2 ) {
 		
-		if ( current_temp >= temp_barier && !timer_bitset) {
-			timer_start = millis();
+		const recipe_segment &seg = program.segments[segment];
+		int32_t target = (int32_t)seg.target * 100;
+		bool cooling = target < ramp_from;
+		
+		// the hold runs from the arrival at the target
+		int32_t soak_band = (seg.flags & RECIPE_SOAK_OVERLAP) ? RECIPE_SOAK_BAND : 0;
+		int coldest = zone_span_set && zone_coldest < current_temp ? zone_coldest : current_temp;
+		int hottest = zone_span_set && zone_hottest > current_temp ? zone_hottest : current_temp;
+		bool arrived = cooling ? hottest <= target : coldest >= target - soak_band;
+		
+		if ( arrived && !timer_bitset) {
+			timer_start = hal::millis();
 			timer_bitset = true;
 		}
 		
 		if ( timer_bitset ) {
-			elapsed_time = (millis() - timer_start) / 60000;
+			elapsed_time = (hal::millis() - timer_start) / 60000;
 		}
 		
-		if ( elapsed_time <= time_barier ) {
+		if ( segment < program.count && elapsed_time <= seg.hold ) {
 			
-			vent_relay(ON);
+			vent_relay( (seg.flags & RECIPE_VENT_OFF) ? OFF : ON );
 			
-			if ( current_temp < (temp_barier - 12) ) {
-				heat_relay(ON);
-			} else if ( (current_temp >= (temp_barier - 12)) && (current_temp < temp_barier) ) {
-				float coefficient = (float)temp_barier / 220.0;
-				heating_power_control( coefficient );
-			} else if (current_temp >= temp_barier) {
-				heat_relay(OFF);
+			if ( hal::millis() - pid_sample_time >= PID_SAMPLE_MS ) {
+				pid_sample_time = hal::millis();
+				
+				setpoint = this->ramp_setpoint( seg );
+				
+				if ( heatup_phase == HEATUP_BOOST ) {
+					// cut back to the holding duty as soon as the heat on its way carries the oven to the barier
+					coast_duty = model.steady_duty(setpoint);
+					if ( model.predict_peak(current_temp, coast_duty) >= setpoint ) {
+						heatup_phase = HEATUP_COAST;
+						coast_peak = current_temp;
+					}
+				}
+				if ( heatup_phase == HEATUP_COAST ) {
+					if ( current_temp > coast_peak ) {
+						coast_peak = current_temp;
+					}
+					if ( current_temp >= setpoint - COAST_BAND || current_temp < coast_peak - COAST_BAND ) {
+						// arrived, or the coast stopped short: the PID takes over from the holding duty
+						heatup_phase = HEATUP_PID;
+						pid.reset();
+						pid.preload( coast_duty );
+					}
+				}
+				
+				if ( heatup_phase == HEATUP_BOOST ) {
+					heat_duty = PID_OUT_MAX;
+				} else if ( heatup_phase == HEATUP_COAST ) {
+					heat_duty = coast_duty;
+				} else {
+					heat_duty = pid.update( setpoint, current_temp );
+				}
 			}
+			heater.set_duty( heat_duty, last_mode != 2 );   // a cycle starts with a fresh window
+			
+		} else if ( segment + 1 < program.count ) {
+			// next segment, the PID carries on from where it is
+			++segment;
+			this->start_segment( program, current_temp );
 			
 		} else {
-			heat_relay(OFF);
+			heater.off();
 			vent_relay(OFF);
 			operation_finished = true;
 			timer_bitset = false;
 			timer_start = 0;
 			elapsed_time = 0;
+			pid.reset();
+			heat_duty = 0;
+		}
+		
+	} else if ( current_mode == 4 ) {
+		// AUTOTUNE: relay feedback around the first target (the temperature barier), the PID is not used
+		vent_relay(ON);
+		
+		if ( autotune.is_idle() && program.count ) {
+			autotune.start( (int32_t)program.segments[0].target * 100 );
+		}
+		// relay feedback switches at once, not at the next window
+		byte duty = autotune.update(current_temp) ? PID_OUT_MAX : PID_OUT_MIN;
+		if ( duty != heat_duty ) {
+			heater.set_duty( duty, true );
 		}
+		heat_duty = duty;
 		
 	} else if ( current_mode == 0 || current_mode == 1) {
-		heat_relay(OFF);
+		heater.off();
 		vent_relay(OFF);
+		autotune.stop();
 		
 		timer_start = 0;
 		elapsed_time = 0;
 		timer_bitset = false;
 		operation_finished = false;
+		pid.reset();
+		heat_duty = 0;
 	} else if ( current_mode == 3 ) {
-		digitalWrite(pin_relay_heat, LOW);
-		digitalWrite(pin_relay_vent, LOW);
+		heater.off();
+		VENT_PIN::low();
+		autotune.stop();
 		timer_start = 0;
 		elapsed_time = 0;
 		timer_bitset = false;
 		operation_finished = false;
+		pid.reset();
+		heat_duty = 0;
 	}
+	
+	model_control( current_mode, current_temp );
+	last_mode = current_mode;
 }
 
 
-bool flow_control::get_heat_relay_state() const
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::set_zone_span( int coldest_temp, int hottest_temp )
 {
-	return heat_relay_state;
+	zone_span_set = true;
+	zone_coldest = coldest_temp;
+	zone_hottest = hottest_temp;
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::start_segment( const recipe &program, int current_temp )
+{
+	timer_start = 0;
+	timer_bitset = false;
+	elapsed_time = 0;
+	segment_start = hal::millis();
+	ramp_from = current_temp;
+	setpoint = current_temp;
+	
+	if ( segment >= program.count ) {
+		return;   // empty recipe, finishes at once
+	}
+	
+	// the ramp continues from the previous target, the first one from the oven
+	const recipe_segment &seg = program.segments[segment];
+	int32_t target = (int32_t)seg.target * 100;
+	ramp_from = segment ? (int32_t)program.segments[segment - 1].target * 100 : current_temp;
+	setpoint = ramp_from;
+	
+	if ( target < ramp_from ) {
+		pid.reset();   // cooling, nothing of the soak integral is left
+	}
+	
+	// a trusted model takes a step heat-up
+	bool far = current_temp < target - BOOST_MIN_ERROR;
+	heatup_phase = (seg.rate == 0 && model.is_valid() && far) ? HEATUP_BOOST : HEATUP_PID;
 }
 
 
-bool flow_control::get_vent_relay_state() const
+template <class HEAT_PIN, class VENT_PIN>
+int32_t flow_control<HEAT_PIN, VENT_PIN>::ramp_setpoint( const recipe_segment &seg ) const
+{
+	int32_t target = (int32_t)seg.target * 100;
+	if ( seg.rate == 0 ) {
+		return target;
+	}
+	
+	int32_t ramp = (int32_t)seg.rate * RECIPE_RATE_UNIT * ((hal::millis() - segment_start) / 1000) / 60;
+	if ( target < ramp_from ) {
+		return ramp_from - ramp > target ? ramp_from - ramp : target;
+	}
+	return ramp_from + ramp < target ? ramp_from + ramp : target;
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::model_control( byte current_mode, int current_temp )
+{
+	// the model learns only with the vent running, as in operation and autotune
+	if ( current_mode != 2 && current_mode != 4 ) {
+		heatup_phase = HEATUP_PID;
+		dead_time_measuring = false;
+		return;
+	}
+	
+	if ( current_mode != last_mode ) {
+		model.restart();            // the heater was off before
+		model_sample_time = hal::millis();
+		model_on_count = 0;
+		model_count = 0;
+	}
+	
+	++model_count;
+	if ( heater.is_on() ) {
+		++model_on_count;
+	}
+	
+	if ( hal::millis() - model_sample_time >= MODEL_SAMPLE_MS ) {
+		model_sample_time += MODEL_SAMPLE_MS;
+		model.update( current_temp, (uint32_t)model_on_count * PID_OUT_MAX / model_count );
+		model_on_count = 0;
+		model_count = 0;
+	}
+	
+	// transport delay: full power from a steady start until the probe sees the rise
+	if ( dead_time_measuring && current_temp > heatup_temp + MODEL_DEAD_RISE ) {
+		model.set_dead_time( hal::millis() - heatup_start );
+		dead_time_measured = true;
+		dead_time_measuring = false;
+	}
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+const thermal_model &flow_control<HEAT_PIN, VENT_PIN>::get_model() const
+{
+	return model;
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+byte flow_control<HEAT_PIN, VENT_PIN>::get_heatup_phase() const
+{
+	return heatup_phase;
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::heater_tick()
+{
+	heater.tick();
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::set_heat_window( uint16_t ms )
+{
+	heater.set_window( ms / HEATER_TICK_MS );
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+bool flow_control<HEAT_PIN, VENT_PIN>::get_heat_relay_state() const
+{
+	return heater.is_on();
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+bool flow_control<HEAT_PIN, VENT_PIN>::get_vent_relay_state() const
 {
 	return vent_relay_state;
 }
 
 
-bool flow_control::is_timer_started() const
+template <class HEAT_PIN, class VENT_PIN>
+bool flow_control<HEAT_PIN, VENT_PIN>::is_timer_started() const
 {
 	return timer_bitset;
 }
 
 
-bool flow_control::is_operation_finished() const
+template <class HEAT_PIN, class VENT_PIN>
+bool flow_control<HEAT_PIN, VENT_PIN>::is_operation_finished() const
 {
 	return operation_finished;
 }
 
 
-int flow_control::get_elapsed_time() const
+template <class HEAT_PIN, class VENT_PIN>
+int flow_control<HEAT_PIN, VENT_PIN>::get_elapsed_time() const
 {
 	return elapsed_time;
 }
 
 
-void flow_control::heat_relay( bool state )
+template <class HEAT_PIN, class VENT_PIN>
+byte flow_control<HEAT_PIN, VENT_PIN>::get_heat_duty() const
 {
-	if ( state ) {
-		digitalWrite(pin_relay_heat, HIGH);
-		heat_relay_state = true;
-	} else {
-		digitalWrite(pin_relay_heat, LOW);
-		heat_relay_state = false;
-	}
+	return heat_duty;
 }
 
 
-void flow_control::vent_relay( bool state )
+template <class HEAT_PIN, class VENT_PIN>
+byte flow_control<HEAT_PIN, VENT_PIN>::get_segment() const
 {
-	if ( state ) {
-		digitalWrite(pin_relay_vent, HIGH);
-		vent_relay_state = true;
-	} else {
-		digitalWrite(pin_relay_vent, LOW);
-		vent_relay_state = false;
-	}
+	return segment;
 }
 
 
-void flow_control::heating_power_control( float coefficient )
+template <class HEAT_PIN, class VENT_PIN>
+int32_t flow_control<HEAT_PIN, VENT_PIN>::get_setpoint() const
 {
-	int heatRelayTimeDelta = millis() % 5000;
-	int period = coefficient * 5000;
-	
-	if ( heatRelayTimeDelta <= period ) {
-		digitalWrite(pin_relay_heat, HIGH);
-		heat_relay_state = true;
-	} else if ( heatRelayTimeDelta > period ) { 
-		digitalWrite(pin_relay_heat, LOW);
-		heat_relay_state = false;
-	}
+	return setpoint;
 }
 
 
-void flow_control::middle_power_heating()
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::set_pid_gains( int32_t kp, int32_t ki, int32_t kd )
 {
-	int heatRelayTimeDelta = millis() % 5000;
-	
-	if ( heatRelayTimeDelta <= 2500 ) {
-		digitalWrite(pin_relay_heat, HIGH);
-		heat_relay_state = true;
-	} else if ( heatRelayTimeDelta > 2500 ) { 
-		digitalWrite(pin_relay_heat, LOW);
-		heat_relay_state = false;
-	}
+	pid.set_gains(kp, ki, kd);
 }
 
 
-void flow_control::low_power_heating()
+template <class HEAT_PIN, class VENT_PIN>
+const relay_autotune &flow_control<HEAT_PIN, VENT_PIN>::get_autotune() const
 {
-	int heatRelayTimeDelta = millis() % 5000;
-	
-	if ( heatRelayTimeDelta <= 1750 ) {
-		digitalWrite(pin_relay_heat, HIGH);
-		heat_relay_state = true;
-	} else if ( heatRelayTimeDelta > 1750 ) { 
-		digitalWrite(pin_relay_heat, LOW);
-		heat_relay_state = false;
+	return autotune;
+}
+
+
+template <class HEAT_PIN, class VENT_PIN>
+void flow_control<HEAT_PIN, VENT_PIN>::vent_relay( bool state )
+{
+	if ( state ) {
+		VENT_PIN::high();
+		vent_relay_state = true;
+	} else {
+		VENT_PIN::low();
+		vent_relay_state = false;
 	}
 }
 
@@ -0,0 +1,161 @@
+#ifndef GPIO_HPP
+#define GPIO_HPP
+
+#include "hal.hpp"
+
+// Compile-time GPIO pins.
+// The pin number is a template parameter, so the port register and the bit
+// mask are constants and every access compiles to a single sbi/cbi/sbis
+// instruction instead of the pin table lookups of digitalWrite/digitalRead.
+// An object of a pin type takes no RAM, all members are static.
+// On the host build the calls are forwarded to the simulator through hal::*.
+
+template <byte PIN>
+class gpio_pin
+{
+	public:
+		static const byte number = PIN;    // Arduino pin number, for tone()
+
+		// D0...D7 on PORTD, D8...D13 on PORTB, A0...A5 on PORTC
+		static const byte bit = PIN < 8 ? PIN : PIN < 14 ? PIN - 8 : PIN - 14;   // bit in the port
+
+		static void set_output();
+		static void set_input();
+		static void set_input_pullup();    // input with the internal pull-up
+
+		static void high();
+		static void low();
+		static void write( bool level );
+		static bool read();
+		static byte read_port();           // the whole input register of the port of the pin
+
+#if defined(ARDUINO)
+	private:
+		static_assert(PIN < 20, "Arduino Uno has pins D0...D13 and A0...A5 (14...19)");
+
+		static const byte mask = 1 << bit;
+
+		static volatile uint8_t &port_register()  { return PIN < 8 ? PORTD : PIN < 14 ? PORTB : PORTC; }
+		static volatile uint8_t &ddr_register()   { return PIN < 8 ? DDRD : PIN < 14 ? DDRB : DDRC; }
+		static volatile uint8_t &pin_register()   { return PIN < 8 ? PIND : PIN < 14 ? PINB : PINC; }
+#endif
+};
+
+
+#if defined(ARDUINO)
+
+template <byte PIN>
+inline void gpio_pin<PIN>::set_output()
+{
+	ddr_register() |= mask;
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::set_input()
+{
+	ddr_register() &= ~mask;
+	port_register() &= ~mask;
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::set_input_pullup()
+{
+	ddr_register() &= ~mask;
+	port_register() |= mask;
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::high()
+{
+	port_register() |= mask;
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::low()
+{
+	port_register() &= ~mask;
+}
+
+
+template <byte PIN>
+inline bool gpio_pin<PIN>::read()
+{
+	return pin_register() & mask;
+}
+
+
+template <byte PIN>
+inline byte gpio_pin<PIN>::read_port()
+{
+	return pin_register();
+}
+
+#else
+
+template <byte PIN>
+inline void gpio_pin<PIN>::set_output()
+{
+	hal::pin_mode(PIN, OUTPUT);
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::set_input()
+{
+	hal::pin_mode(PIN, INPUT);
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::set_input_pullup()
+{
+	hal::pin_mode(PIN, INPUT_PULLUP);
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::high()
+{
+	hal::digital_write(PIN, HIGH);
+}
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::low()
+{
+	hal::digital_write(PIN, LOW);
+}
+
+
+template <byte PIN>
+inline bool gpio_pin<PIN>::read()
+{
+	return hal::digital_read(PIN);
+}
+
+
+template <byte PIN>
+inline byte gpio_pin<PIN>::read_port()
+{
+	return PIN < 8 ? hal::read_port_d() : PIN < 14 ? hal::read_port_b() : hal::read_port_c();
+}
+
+#endif
+
+
+template <byte PIN>
+inline void gpio_pin<PIN>::write( bool level )
+{
+	if ( level ) {
+		high();
+	} else {
+		low();
+	}
+}
+
+
+#endif // GPIO_HPP
@@ -0,0 +1,75 @@
+#ifndef HAL_HPP
+#define HAL_HPP
+
+// Hardware abstraction layer.
+// On the ATmega328P every call is forwarded to the Arduino core, on the host
+// build (host/ directory) the same calls are implemented by the simulator,
+// so the control classes can be compiled and run on Linux unchanged.
+
+#if defined(ARDUINO)
+	#include <Arduino.h>
+	#include <EEPROM.h>
+	#include <avr/eeprom.h>   // eeprom_is_ready()
+#else
+	#include <stdint.h>
+
+	typedef uint8_t byte;
+
+	#define LOW           0
+	#define HIGH          1
+
+	#define INPUT         0
+	#define OUTPUT        1
+	#define INPUT_PULLUP  2
+
+	// no separate flash address space on the host
+	#define PROGMEM
+	#define pgm_read_byte(addr)  (*(const uint8_t *)(addr))
+	#define pgm_read_word(addr)  (*(const uint16_t *)(addr))
+#endif
+
+
+namespace hal
+{
+#if defined(ARDUINO)
+
+	inline uint32_t millis()                          { return ::millis(); }
+	inline uint32_t micros()                          { return ::micros(); }
+
+	inline void pin_mode( byte pin, byte mode )       { ::pinMode(pin, mode); }
+	inline void digital_write( byte pin, byte level ) { ::digitalWrite(pin, level); }
+	inline byte digital_read( byte pin )              { return ::digitalRead(pin); }
+	inline byte read_port_b()                         { return PINB; }             // D8...D13 as bits 0...5
+	inline byte read_port_c()                         { return PINC; }             // A0...A5 as bits 0...5
+	inline byte read_port_d()                         { return PIND; }             // D0...D7 as bits 0...7
+
+	inline void tone( byte pin, unsigned int frequency, unsigned long duration ) { ::tone(pin, frequency, duration); }
+
+	inline byte eeprom_read( int addr )               { return EEPROM.read(addr); }
+	inline void eeprom_write( int addr, byte value )  { EEPROM.update(addr, value); }   // update() skips the write if value is unchanged
+	inline bool eeprom_ready()                        { return eeprom_is_ready(); }      // the last write is done, the next one will not wait
+
+#else
+
+	// Implemented by the host simulator (host/sim_hal.cpp)
+	uint32_t millis();
+	uint32_t micros();
+
+	void pin_mode( byte pin, byte mode );
+	void digital_write( byte pin, byte level );
+	byte digital_read( byte pin );
+	byte read_port_b();
+	byte read_port_c();
+	byte read_port_d();
+
+	void tone( byte pin, unsigned int frequency, unsigned long duration );
+
+	byte eeprom_read( int addr );
+	void eeprom_write( int addr, byte value );
+	bool eeprom_ready();
+
+#endif
+}
+
+
+#endif // HAL_HPP
@@ -0,0 +1,257 @@
+#ifndef HEATER_OUTPUT_HPP
+#define HEATER_OUTPUT_HPP
+
+#include "hal.hpp"
+#include "gpio.hpp"
+
+#if defined(ARDUINO)
+	#include <avr/power.h>
+#endif
+
+// Interrupt driven time-proportioning output for the heater relay or SSR.
+// The control code only publishes a duty 0...255. tick() runs from the Timer1
+// compare interrupt every HEATER_TICK_MS and switches the pin on exact tick
+// boundaries, however long the loop pass takes. A window is HEATER_WINDOW_TICKS
+// ticks (1/500 resolution), set_window() changes it for the host sweeps. A pulse starts only at the start of a window and
+// ends when the window has had the on-time of the published duty, so a lower
+// duty takes effect at once and a pulse never comes twice in one window.
+//
+// On-time a window could not give, a duty raised after its pulse ended, a
+// pulse shorter than HEATER_MIN_ON_MS left out, and on-time a window gave
+// too much, a gap shorter than HEATER_MIN_OFF_MS filled, is carried to the
+// next window. The delivered power follows the duty on average.
+//
+// heater_window is the window without a pin, its tick() returns the level;
+// the followers of zone_bank drive their relays with it from the same
+// interrupt, each window started a fraction later.
+
+#define HEAT_WINDOW_MS       5000   // heater time-proportioning window
+#define HEATER_TICK_MS       10     // Timer1 period
+#define HEATER_WINDOW_TICKS  (HEAT_WINDOW_MS / HEATER_TICK_MS)
+#define HEATER_WINDOW_MAX    6000   // ticks, a minute, the carry stays within int16_t
+#define HEATER_MIN_ON_MS     0      // shortest pulse, e.g. 100 for a mechanical relay
+#define HEATER_MIN_OFF_MS    0      // shortest gap
+
+#define HEATER_TIMER_PRESCALER  64
+
+
+// Starts Timer1 in CTC mode, an interrupt every HEATER_TICK_MS
+inline void heater_timer_init()
+{
+#if defined(ARDUINO)
+	power_timer1_enable();
+	cli();
+	TCCR1A = 0;
+	TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);   // prescaler 64
+	TCNT1 = 0;
+	OCR1A = (uint32_t)F_CPU / HEATER_TIMER_PRESCALER / 1000 * HEATER_TICK_MS - 1;
+	TIMSK1 |= _BV(OCIE1A);
+	sei();
+#endif
+}
+
+
+// Stops Timer1 and its clock, no more interrupts; only with every heater off,
+// heater_timer_init() starts it again
+inline void heater_timer_stop()
+{
+#if defined(ARDUINO)
+	TIMSK1 &= ~_BV(OCIE1A);
+	TCCR1B = 0;
+	power_timer1_disable();
+#endif
+}
+
+
+class heater_window
+{
+	public:
+		heater_window();
+
+		void init( uint16_t delay = 0 );              // off, the first window starts after delay ticks
+
+		// Duty for the next window, 0...255; restart: end the running window at the next tick,
+		// for an on/off control that must act at once
+		void set_duty( byte duty, bool restart = false );
+		void off();                                   // duty 0, the window ends
+		void set_window( uint16_t ticks );            // window length, HEATER_WINDOW_MAX at most, from the next window
+
+		bool tick();                                  // every HEATER_TICK_MS, from the interrupt, returns the level
+
+		byte get_duty() const;                        // published duty
+		bool is_on() const;                           // level of the last tick
+
+	private:
+		uint16_t on_ticks( byte duty ) const;
+
+	protected:
+		volatile byte duty;
+		volatile bool restart_window;
+		volatile bool on;
+
+		uint16_t window;                 // ticks, HEATER_WINDOW_TICKS unless set
+		uint16_t count;                  // ticks into the window
+		bool pulse_done;                 // the pulse of this window has ended
+		uint32_t requested;              // on ticks of the published duty summed over the ticks of this window
+		uint16_t delivered;              // on ticks of this window
+		int16_t carry;                   // on ticks owed from the last windows (> 0) or given in advance (< 0)
+};
+
+
+// PIN: gpio_pin<> type of the heater relay
+template <class PIN>
+class heater_output : public heater_window
+{
+	public:
+		void init();                                  // pin low, Timer1 started on the Arduino
+		void off();                                   // pin low at once and stays low
+		void tick();                                  // to be called every HEATER_TICK_MS, from the interrupt
+};
+
+
+heater_window::heater_window()
+			 : window(HEATER_WINDOW_TICKS)
+{
+
+}
+
+
+void heater_window::init( uint16_t delay )
+{
+	duty = 0;
+	restart_window = false;
+	on = false;
+	count = window - 1 - delay % window;   // a new window at tick delay + 1
+	pulse_done = true;               // nothing before it
+	requested = 0;
+	delivered = 0;
+	carry = 0;
+}
+
+
+void heater_window::set_duty( byte value, bool restart )
+{
+	duty = value;   // single byte, no need to block the interrupt
+	if ( restart ) {
+		restart_window = true;
+	}
+}
+
+
+void heater_window::off()
+{
+	duty = 0;
+	restart_window = true;
+	on = false;
+}
+
+
+void heater_window::set_window( uint16_t ticks )
+{
+	// a window of the old length was requested, the next one starts over
+#if defined(ARDUINO)
+	uint8_t sreg = SREG;   // two bytes the interrupt reads
+	cli();
+#endif
+	window = ticks < 1 ? 1 : ticks > HEATER_WINDOW_MAX ? HEATER_WINDOW_MAX : ticks;
+	restart_window = true;
+#if defined(ARDUINO)
+	SREG = sreg;
+#endif
+}
+
+
+bool heater_window::tick()
+{
+	if ( restart_window ) {
+		restart_window = false;
+		count = window - 1;
+		requested = 0;
+		delivered = 0;
+		carry = 0;
+	}
+
+	if ( ++count >= window ) {
+		// settle the window that ended, no carry beyond one window
+		int16_t owed = carry + (int16_t)(requested / window) - (int16_t)delivered;
+		carry = owed > (int16_t)window ? window : owed < -(int16_t)window ? -(int16_t)window : owed;
+
+		count = 0;
+		pulse_done = false;
+		requested = 0;
+		delivered = 0;
+	}
+
+	uint16_t ticks = on_ticks(duty);
+	requested += ticks;
+
+	int16_t wanted = ticks + carry;
+	if ( wanted < HEATER_MIN_ON_MS / HEATER_TICK_MS ) {
+		wanted = 0;
+	} else if ( (int16_t)window - wanted < HEATER_MIN_OFF_MS / HEATER_TICK_MS ) {
+		wanted = window;
+	}
+
+	// a running pulse lasts at least the minimum on-time
+	bool level = !pulse_done && ((int16_t)count < wanted || (on && count < HEATER_MIN_ON_MS / HEATER_TICK_MS));
+	if ( on && !level ) {
+		pulse_done = true;
+	}
+
+	if ( level ) {
+		++delivered;
+	}
+	on = level;
+	return level;
+}
+
+
+byte heater_window::get_duty() const
+{
+	return duty;
+}
+
+
+bool heater_window::is_on() const
+{
+	return on;
+}
+
+
+uint16_t heater_window::on_ticks( byte duty ) const
+{
+	// 0 and 255 are off and on for the whole window
+	return ((uint32_t)duty * window + 127) / 255;
+}
+
+
+template <class PIN>
+void heater_output<PIN>::init()
+{
+	PIN::set_output();
+	PIN::low();
+	heater_window::init();
+	heater_timer_init();
+}
+
+
+template <class PIN>
+void heater_output<PIN>::off()
+{
+	heater_window::off();
+	PIN::low();
+}
+
+
+template <class PIN>
+void heater_output<PIN>::tick()
+{
+	if ( heater_window::tick() ) {
+		PIN::high();
+	} else {
+		PIN::low();
+	}
+}
+
+
+#endif // HEATER_OUTPUT_HPP
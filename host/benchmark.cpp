@@ -0,0 +1,213 @@
+// Controller performance scorecard.
+// Runs every scenario of a scenario file through the simulator, one process
+// per scenario since the firmware objects are globals, reads the "kpi" lines
+// that -k prints and compares each KPI with its stored baseline. A KPI worse
+// than its baseline by more than the tolerance fails the run; time_in_band is
+// better when higher, all others when lower. A tolerance ending in % is
+// relative to the baseline.
+//
+//   make -C host bench
+//   host/benchmark [-s simulator] [-u] [scenarios.txt]
+//
+// -u prints the scenario file again with the measured values as the
+// baselines, for a change that is meant to move them.
+//
+// Scenario file:
+//   scenario <name> <simulator options>
+//     <kpi> <baseline> <tolerance>
+//   ...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
+#define DEF_SCENARIOS  "benchmark.txt"
+#define DEF_SIMULATOR  "./simulator"
+#define LINE_MAX_LEN   512
+
+
+struct kpi_limit
+{
+	std::string name;
+	double baseline;
+	double tolerance;
+	bool relative;           // tolerance in percent of the baseline
+	double value;
+	bool measured;
+};
+
+
+struct scenario
+{
+	std::string comments;    // comment and blank lines before the scenario, kept by -u
+	std::string name;
+	std::string options;
+	std::vector<kpi_limit> kpis;
+};
+
+
+static bool higher_is_better( const std::string &kpi )
+{
+	return kpi == "time_in_band";
+}
+
+
+static bool load_scenarios( const char *path, std::vector<scenario> &scenarios, std::string &trailer )
+{
+	FILE *in = fopen(path, "r");
+	if ( !in ) {
+		perror(path);
+		return false;
+	}
+
+	char line[LINE_MAX_LEN];
+	int number = 0;
+	std::string comments;
+	while ( fgets(line, sizeof line, in) ) {
+		++number;
+		line[strcspn(line, "\r\n")] = 0;
+		const char *text = line + strspn(line, " \t");
+		if ( !*text || *text == '#' ) {
+			comments += line;
+			comments += '\n';
+			continue;
+		}
+
+		char name[64];
+		int used = 0;
+		if ( sscanf(text, "scenario %63s %n", name, &used) >= 1 && used ) {
+			scenario s;
+			s.comments = comments;
+			s.name = name;
+			s.options = text + used;
+			scenarios.push_back(s);
+			comments.clear();
+			continue;
+		}
+
+		kpi_limit k;
+		char tolerance[32];
+		if ( scenarios.empty() || sscanf(text, "%63s %lf %31s", name, &k.baseline, tolerance) != 3 ) {
+			fprintf(stderr, "%s:%d: expected 'scenario <name> <options>' or '<kpi> <baseline> <tolerance>'\n", path, number);
+			fclose(in);
+			return false;
+		}
+		k.name = name;
+		k.relative = tolerance[strlen(tolerance) - 1] == '%';
+		k.tolerance = atof(tolerance);
+		k.value = 0;
+		k.measured = false;
+		scenarios.back().kpis.push_back(k);
+	}
+
+	trailer = comments;
+	fclose(in);
+	return true;
+}
+
+
+// Runs the simulator, fills in the measured values, false if it could not run or the cycle did not finish
+static bool run_scenario( const char *simulator, scenario &s )
+{
+	std::string command = std::string(simulator) + " -k " + s.options + " 2>&1";
+	FILE *out = popen(command.c_str(), "r");
+	if ( !out ) {
+		perror(simulator);
+		return false;
+	}
+
+	char line[LINE_MAX_LEN];
+	while ( fgets(line, sizeof line, out) ) {
+		char name[64];
+		double value;
+		if ( sscanf(line, "kpi %63s %lf", name, &value) != 2 ) {
+			continue;
+		}
+		for ( size_t i = 0; i < s.kpis.size(); ++i ) {
+			if ( s.kpis[i].name == name ) {
+				s.kpis[i].value = value;
+				s.kpis[i].measured = true;
+			}
+		}
+	}
+	return pclose(out) == 0;
+}
+
+
+int main( int argc, char **argv )
+{
+	const char *simulator = DEF_SIMULATOR;
+	bool update = false;
+
+	int opt;
+	while ( (opt = getopt(argc, argv, "s:u")) != -1 ) {
+		switch ( opt ) {
+			case 's': simulator = optarg; break;
+			case 'u': update = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-s simulator] [-u] [scenarios.txt]\n", argv[0]);
+				return 2;
+		}
+	}
+	const char *path = optind < argc ? argv[optind] : DEF_SCENARIOS;
+
+	std::vector<scenario> scenarios;
+	std::string trailer;
+	if ( !load_scenarios(path, scenarios, trailer) ) {
+		return 2;
+	}
+
+	int regressions = 0;
+	for ( size_t i = 0; i < scenarios.size(); ++i ) {
+		scenario &s = scenarios[i];
+		bool finished = run_scenario(simulator, s);
+
+		if ( update ) {
+			printf("%sscenario %s%s%s\n", s.comments.c_str(), s.name.c_str(), s.options.empty() ? "" : " ", s.options.c_str());
+			for ( size_t j = 0; j < s.kpis.size(); ++j ) {
+				const kpi_limit &k = s.kpis[j];
+				printf("  %-18s %10.2f  %g%s\n", k.name.c_str(), k.measured ? k.value : k.baseline, k.tolerance,
+					   k.relative ? "%" : "");
+			}
+			continue;
+		}
+
+		printf("%s%s\n", s.name.c_str(), finished ? "" : "  cycle did not finish");
+		if ( !finished ) {
+			++regressions;
+		}
+		for ( size_t j = 0; j < s.kpis.size(); ++j ) {
+			const kpi_limit &k = s.kpis[j];
+			double tolerance = k.relative ? fabs(k.baseline) * k.tolerance / 100 : k.tolerance;
+			double worse = higher_is_better(k.name) ? k.baseline - k.value : k.value - k.baseline;
+
+			const char *status = "ok";
+			if ( !k.measured ) {
+				status = "MISSING";
+				++regressions;
+			} else if ( worse > tolerance ) {
+				status = "REGRESSION";
+				++regressions;
+			} else if ( -worse > tolerance ) {
+				status = "improved";
+			}
+			printf("  %-18s %10.2f  baseline %10.2f  %+9.2f  %s\n", k.name.c_str(), k.value, k.baseline,
+				   k.value - k.baseline, status);
+		}
+	}
+
+	if ( update ) {
+		printf("%s", trailer.c_str());
+		return 0;
+	}
+	if ( regressions ) {
+		printf("%d KPI regressions\n", regressions);
+		return 1;
+	}
+	printf("all KPIs within their baselines\n");
+	return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef OVEN_MODEL_HPP
+#define OVEN_MODEL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// First-order-plus-dead-time model of the hot-air chamber:
+//
+//   dT/dt = ( ambient + gain * P(t - dead_time) - T ) / time_constant
+//
+// P is the heater power 0..1 averaged over DEAD_TIME_SLOT_MS slots.
+// Disturbances for the benchmark scenarios: an open door multiplies the heat
+// loss to the room, a load at room temperature adds to the thermal mass and
+// pulls the chamber towards ambient as it goes in.
+
+#define DEF_OVEN_AMBIENT        22.0f    // room temperature, C
+#define DEF_OVEN_GAIN           260.0f   // steady-state rise at full heater power, C
+#define DEF_OVEN_TIME_CONSTANT  1500.0f  // chamber time constant, s
+#define DEF_OVEN_DEAD_TIME      60.0f    // heater to probe transport delay, s
+
+#define DEAD_TIME_SLOT_MS       100      // resolution of the dead time line
+
+
+class oven_model
+{
+	public:
+		oven_model( float ambient = DEF_OVEN_AMBIENT, float gain = DEF_OVEN_GAIN,
+					float time_constant = DEF_OVEN_TIME_CONSTANT, float dead_time = DEF_OVEN_DEAD_TIME );
+
+		void step( bool heater_on, uint32_t dt_ms );   // integrate dt_ms of simulated time
+
+		void set_loss( float factor );                 // heat loss to the room, 1 with the door closed
+		void add_load( float mass );                   // load at ambient, in chamber thermal masses
+
+		float temperature() const;
+		float ambient() const;
+
+	protected:
+		const float ambient_temp;
+		const float gain;
+		const float time_constant;
+
+		float temp;                      // chamber temperature at the probe
+		float loss;
+		float capacity;                  // thermal mass, 1 for the empty chamber
+
+		std::vector<float> delay_line;   // heater power history, one entry per slot
+		size_t delay_head;
+		uint32_t slot_on_ms;             // heater on-time in the current slot
+		uint32_t slot_elapsed_ms;        // elapsed time in the current slot
+};
+
+
+inline oven_model::oven_model( float amb, float g, float tc, float dt )
+	: ambient_temp(amb), gain(g), time_constant(tc), temp(amb), loss(1.0f), capacity(1.0f),
+	  delay_line(size_t(dt * 1000 / DEAD_TIME_SLOT_MS) + 1, 0.0f), delay_head(0), slot_on_ms(0), slot_elapsed_ms(0)
+{
+
+}
+
+
+inline void oven_model::step( bool heater_on, uint32_t dt_ms )
+{
+	while ( dt_ms ) {
+		uint32_t chunk = DEAD_TIME_SLOT_MS - slot_elapsed_ms;
+		if ( chunk > dt_ms ) {
+			chunk = dt_ms;
+		}
+
+		if ( heater_on ) {
+			slot_on_ms += chunk;
+		}
+		slot_elapsed_ms += chunk;
+		dt_ms -= chunk;
+
+		// the oldest slot in the delay line is what reaches the probe now
+		float power = delay_line[delay_head];
+		temp += (ambient_temp + gain * power - temp - (loss - 1.0f) * (temp - ambient_temp)) * (chunk / 1000.0f) /
+				(time_constant * capacity);
+
+		if ( slot_elapsed_ms == DEAD_TIME_SLOT_MS ) {
+			delay_line[delay_head] = float(slot_on_ms) / DEAD_TIME_SLOT_MS;
+			delay_head = (delay_head + 1) % delay_line.size();
+			slot_on_ms = 0;
+			slot_elapsed_ms = 0;
+		}
+	}
+}
+
+
+inline void oven_model::set_loss( float factor )
+{
+	loss = factor;
+}
+
+
+inline void oven_model::add_load( float mass )
+{
+	temp = (temp * capacity + ambient_temp * mass) / (capacity + mass);
+	capacity += mass;
+}
+
+
+inline float oven_model::temperature() const
+{
+	return temp;
+}
+
+
+inline float oven_model::ambient() const
+{
+	return ambient_temp;
+}
+
+
+#endif // OVEN_MODEL_HPP
@@ -0,0 +1,26 @@
+#ifndef SIM_HPP
+#define SIM_HPP
+
+#include "../hal.hpp"
+
+// Simulator side of the host HAL: a simulated millisecond clock, pin levels,
+// buttons, buzzer and EEPROM that the firmware classes talk to through hal::*.
+// Each thread has a board of its own.
+
+#define SIM_PIN_COUNT     20     // D0..D13, A0..A5 of the Arduino Uno
+#define SIM_EEPROM_SIZE   1024   // ATmega328P EEPROM size
+
+namespace sim
+{
+	void reset();                              // clock to zero, pins released, EEPROM erased (0xFF)
+	void advance( uint32_t ms );               // advance the simulated clock
+
+	bool pin_level( byte pin );                // level driven by the firmware on an output pin
+	void set_button( byte pin, bool pressed ); // pressed button pulls the INPUT_PULLUP pin low
+
+	unsigned int tone_count();                 // number of tone() calls so far
+	unsigned int last_tone_frequency();
+}
+
+
+#endif // SIM_HPP
@@ -0,0 +1,165 @@
+#include <string.h>
+#include "sim.hpp"
+
+// Host implementation of the hal:: functions declared in hal.hpp.
+// The simulated board is per thread, so host/sweep can run one controller on
+// each worker thread.
+
+namespace
+{
+	thread_local uint32_t clock_ms;
+
+	thread_local byte pin_modes[SIM_PIN_COUNT];
+	thread_local byte pin_levels[SIM_PIN_COUNT];
+	thread_local bool buttons_pressed[SIM_PIN_COUNT];
+
+	thread_local unsigned int tones;
+	thread_local unsigned int tone_frequency;
+
+	thread_local byte eeprom[SIM_EEPROM_SIZE];
+}
+
+
+/////////////////////////////////////////////////////////////// simulator control
+
+void sim::reset()
+{
+	clock_ms = 0;
+	memset(pin_modes, INPUT, sizeof(pin_modes));
+	memset(pin_levels, LOW, sizeof(pin_levels));
+	memset(buttons_pressed, 0, sizeof(buttons_pressed));
+	tones = 0;
+	tone_frequency = 0;
+	memset(eeprom, 0xFF, sizeof(eeprom));
+}
+
+
+void sim::advance( uint32_t ms )
+{
+	clock_ms += ms;
+}
+
+
+bool sim::pin_level( byte pin )
+{
+	return pin < SIM_PIN_COUNT && pin_modes[pin] == OUTPUT && pin_levels[pin] == HIGH;
+}
+
+
+void sim::set_button( byte pin, bool pressed )
+{
+	if ( pin < SIM_PIN_COUNT ) {
+		buttons_pressed[pin] = pressed;
+	}
+}
+
+
+unsigned int sim::tone_count()
+{
+	return tones;
+}
+
+
+unsigned int sim::last_tone_frequency()
+{
+	return tone_frequency;
+}
+
+
+/////////////////////////////////////////////////////////////// hal
+
+uint32_t hal::millis()
+{
+	return clock_ms;
+}
+
+
+uint32_t hal::micros()
+{
+	return clock_ms * 1000;
+}
+
+
+void hal::pin_mode( byte pin, byte mode )
+{
+	if ( pin < SIM_PIN_COUNT ) {
+		pin_modes[pin] = mode;
+	}
+}
+
+
+void hal::digital_write( byte pin, byte level )
+{
+	if ( pin < SIM_PIN_COUNT ) {
+		pin_levels[pin] = level;
+	}
+}
+
+
+byte hal::digital_read( byte pin )
+{
+	if ( pin >= SIM_PIN_COUNT ) {
+		return LOW;
+	}
+	if ( pin_modes[pin] == INPUT_PULLUP ) {
+		return buttons_pressed[pin] ? LOW : HIGH;
+	}
+	return pin_levels[pin];
+}
+
+
+byte hal::read_port_b()
+{
+	byte port = 0;
+	for ( byte bit = 0; bit < 6; ++bit ) {
+		port |= hal::digital_read(8 + bit) << bit;
+	}
+	return port;
+}
+
+
+byte hal::read_port_c()
+{
+	byte port = 0;
+	for ( byte bit = 0; bit < 6; ++bit ) {
+		port |= hal::digital_read(14 + bit) << bit;
+	}
+	return port;
+}
+
+
+byte hal::read_port_d()
+{
+	byte port = 0;
+	for ( byte bit = 0; bit < 8; ++bit ) {
+		port |= hal::digital_read(bit) << bit;
+	}
+	return port;
+}
+
+
+void hal::tone( byte, unsigned int frequency, unsigned long )
+{
+	++tones;
+	tone_frequency = frequency;
+}
+
+
+byte hal::eeprom_read( int addr )
+{
+	return (addr >= 0 && addr < SIM_EEPROM_SIZE) ? eeprom[addr] : 0xFF;
+}
+
+
+void hal::eeprom_write( int addr, byte value )
+{
+	if ( addr >= 0 && addr < SIM_EEPROM_SIZE ) {
+		eeprom[addr] = value;
+	}
+}
+
+
+bool hal::eeprom_ready()
+{
+	return true;   // simulated writes complete at once
+}
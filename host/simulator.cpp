@@ -0,0 +1,886 @@
+// Host-side closed-loop simulator.
+// Runs mode_control/flow_control/button_bank/buzzer_control from the
+// sketch against the simulated HAL and a first-order-plus-dead-time oven,
+// pressing START and running a full sterilization cycle in simulated time.
+//
+//   make -C host && host/simulator [-t temp] [-m minutes] [-s step_ms] [-c trace.csv] [-b telemetry.bin] [-n noise_centi]
+//                                  [-g kp,ki,kd] [-a] [-r cycles] [-R target:rate:hold[:flags],...] [-z zones] [-H history.csv]
+//                                  [-d minute:seconds[:loss]] [-l minute:mass] [-F minute:fault] [-S minute:command] [-k]
+//
+// -g seeds the PID gains, -a holds PLUS and MINUS instead of pressing START
+// and runs the relay feedback autotune, printing the gains it found.
+// -r runs several cycles, each after the oven has cooled down, so the online
+// oven model learnt in one cycle drives the heat-up of the next.
+// -R stores a recipe of up to RECIPE_MAX_SEGMENTS segments (recipe.hpp):
+// target C, ramp rate in 0.1 C/min (0: step), hold minutes, flags.
+// -z gives zones 1...N-1 chambers of their own, each slower than the last,
+// following zone 0 (zone_bank.hpp); without it they mirror zone 0.
+// -H writes the run history of the last cycle (run_history.hpp) as decoded from its RAM buffer.
+// -d opens the door for a while at a minute of each cycle, multiplying the heat loss, -l puts a
+// load at room temperature into the chamber, in chamber thermal masses.
+// -F injects a fault at a minute of the cycle, for the safety monitor (safety_monitor.hpp): probe (the
+// probe falls out and cools towards the room), freeze (the reading stops changing), weld (the heater relay sticks on),
+// open (the heater gives no heat); minute:kind:zone puts it into a zone of -z.
+// The run ends when the monitor trips, unless a -S command is still to come.
+// -S sends a line to the serial command parser (serial_command.hpp) at a minute from power-up and
+// prints the reply, as often as given; the mode, parameter and recipe commands are simulated.
+// -k adds the KPIs of the last cycle as "kpi name value" lines, for host/benchmark.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "sim.hpp"
+#include "oven_model.hpp"
+#include "../button_bank.hpp"
+#include "../buzzer.hpp"
+#include "../mode_control.hpp"
+#include "../flow_control.hpp"
+#include "../scheduler.hpp"
+#include "../telemetry.hpp"
+#include "../sensor_filter.hpp"
+#include "../zone_bank.hpp"
+#include "../run_history.hpp"
+#include "../cycle_log.hpp"
+#include "../safety_monitor.hpp"
+#include "../power_idle.hpp"
+#include "../serial_command.hpp"
+
+// Pinout as in PID_controller.ino
+#define PIN_RELAY_HEAT     6
+#define PIN_RELAY_VENT     7
+#define PIN_BUTTON_PLUS    9
+#define PIN_BUTTON_MINUS   10
+#define PIN_BUTTON_SELECT  11
+#define PIN_BUTTON_START   12
+#define PIN_BUZZER         8
+
+#define DEF_SIM_STEP_MS    1         // simulated duration of one loop() pass
+#define START_PRESS_AT_MS  1000      // START is pressed one second after power-up
+#define START_PRESS_MS     200       // and held for a short press
+#define COMBO_PRESS_MS     3500      // PLUS and MINUS held into secret press for autotune
+#define COOLED_MARGIN      20        // with -r the next cycle starts this close to ambient, C
+#define SETTLE_BAND        1.0f      // KPI band around the setpoint during the holds, C
+#define DEF_DOOR_LOSS      8.0f      // heat loss multiplier with the door open
+#define PROBE_TIME_CONSTANT  60.0f   // s, a probe out of the chamber cools towards the room
+#define SIM_COMMANDS       16        // -S lines
+#define SERIAL_REPLY_MAX   96
+
+#define SIM_ZONES          3         // zone_bank size
+const byte zone_heat_pins[] PROGMEM = { 14, 16 };   // A0, A2 for zones 1, 2
+const byte zone_vent_pins[] PROGMEM = { 15, 17 };   // A1, A3
+
+
+button_bank<PIN_BUTTON_PLUS> buttons;
+power_idle<PIN_BUTTON_PLUS> idle;
+
+mode_control mode;
+flow_control< gpio_pin<PIN_RELAY_HEAT>, gpio_pin<PIN_RELAY_VENT> > flow;
+buzzer_control< gpio_pin<PIN_BUZZER> > buzzer;
+
+oven_model *ovens[SIM_ZONES];   // NULL: the zone mirrors zone 0
+
+run_history history;
+safety_monitor<SIM_ZONES> safety;
+cycle_log cycles;
+command_line commands;
+
+
+/////////////////////////////////////////////////////////////// tasks as in PID_controller.ino
+
+#define TASK_SENSOR_MS   20
+#define TASK_CONTROL_MS  100
+#define TASK_BUTTONS_MS  BUTTON_TICK_MS
+#define TASK_TELEMETRY_MS  50
+#define TASK_SERIAL_MS   5
+#define TASK_EEPROM_MS   4
+
+enum { TASK_SENSOR, TASK_CONTROL, TASK_BUTTONS, TASK_BUZZER, TASK_TELEMETRY, TASK_SERIAL, TASK_EEPROM, TASK_COUNT };
+
+task_scheduler<TASK_COUNT> scheduler;
+
+// temperature filter as in PID_controller.ino, one per zone
+typedef filter_chain< median_filter<5>, filter_chain< iir_filter<3>, no_filter > > temp_filter;
+zone_bank<SIM_ZONES, temp_filter> zones(zone_heat_pins, zone_vent_pins);
+int noise_centi = 0;      // peak measurement noise
+
+// injected faults (-F)
+enum { FAULT_NONE, FAULT_PROBE, FAULT_FREEZE, FAULT_WELD, FAULT_OPEN };
+int fault_kind = FAULT_NONE;
+int fault_zone = 0;
+bool fault_active = false;
+int fault_frozen_temp = 0;        // reading when the fault came
+uint32_t fault_start_ms = 0;
+
+// serial commands (-S), received a byte at a time as from the UART
+struct sim_command
+{
+	float minute;
+	char text[COMMAND_LINE_MAX * 2];   // with the line end, longer than the parser takes
+};
+sim_command sim_commands[SIM_COMMANDS];
+int command_count = 0;
+int command_next = 0;             // next to be sent
+
+struct sim_serial
+{
+	const char *rx;               // rest of the line being received
+	int available() const { return rx && *rx; }
+	int read() { return *rx++; }
+} serial_in = { NULL };
+
+int current_temp_centi = 0;
+uint32_t finished_ms = 0;
+uint32_t autotune_ms = 0;
+FILE *telemetry = NULL;
+
+
+void task_sensor()
+{
+	// all zones at once, the round-robin of max31865_bank is not simulated
+	int zone_0_temp = 0;
+	for ( byte zone = 0; zone < SIM_ZONES; ++zone ) {
+		int temp = zone_0_temp;
+		if ( zone == 0 || ovens[zone] ) {
+			temp = int( ovens[zone]->temperature() * 100 );
+			if ( noise_centi ) {
+				temp += rand() % (2 * noise_centi + 1) - noise_centi;
+			}
+		}
+		if ( zone == fault_zone && fault_active ) {
+			if ( fault_kind == FAULT_PROBE ) {
+				float probe = ovens[zone]->ambient() * 100 + (fault_frozen_temp - ovens[zone]->ambient() * 100) *
+							  expf( -float(hal::millis() - fault_start_ms) / (PROBE_TIME_CONSTANT * 1000) );
+				temp += int(probe) - int( ovens[zone]->temperature() * 100 );
+			} else if ( fault_kind == FAULT_FREEZE ) {
+				temp = fault_frozen_temp;
+			}
+		}
+		if ( zone == 0 ) {
+			zone_0_temp = temp;
+		}
+		zones.sample(zone, temp, 0);
+		if ( zone == 0 || ovens[zone] ) {
+			// a mirrored zone does not follow its own heater
+			safety.sample( zone, zones.get_temp(zone), temp, zone ? zones.get_heat_duty(zone) : flow.get_heat_duty() );
+		}
+	}
+	current_temp_centi = zones.get_temp(0);
+}
+
+
+void task_control()
+{
+	int current_temp = current_temp_centi / 100;
+
+	if ( current_temp < 0 || current_temp > 230 ) {
+		mode.set_current_mode(3);
+	}
+	bool acknowledged = mode.take_fault_ack();
+	if ( safety.get_fault() ) {
+		if ( acknowledged && mode.get_current_mode() != 3 ) {
+			safety.clear();   // acknowledged with PLUS and MINUS or "ack"
+		} else {
+			mode.set_current_mode(3);
+		}
+	}
+
+	recipe program;
+	mode.get_recipe( program );
+	flow.set_zone_span( zones.get_coldest(), zones.get_hottest() );
+	flow.control( mode.get_current_mode(), current_temp_centi, program );
+	zones.control( mode.get_current_mode() == 2 && !flow.is_operation_finished(), flow.get_setpoint() );
+
+	byte current_mode = mode.get_current_mode();
+	if ( current_mode == 2 && !history.is_running() && !flow.is_operation_finished() ) {
+		uint16_t hold = recipe_total_hold(program);
+		history.start( current_temp_centi, recipe_peak_target(program), hold > 255 ? 255 : hold );
+	}
+	if ( history.is_running() ) {
+		if ( flow.is_operation_finished() || current_mode != 2 ) {
+			history.finish( flow.is_operation_finished() ? HISTORY_FINISHED : current_mode == 3 ? HISTORY_FAULT : HISTORY_ABORTED );
+			cycles.append( history.get_summary() );
+		} else {
+			history.sample( current_temp_centi, flow.get_heat_duty(), flow.is_timer_started() );
+		}
+	}
+
+	if ( flow.is_operation_finished() ) {
+		buzzer.finish();
+		scheduler.trigger(TASK_BUZZER);
+		mode.set_current_mode(0);
+		finished_ms = hal::millis();
+	}
+
+	const relay_autotune &autotune = flow.get_autotune();
+	if ( autotune.is_finished() || autotune.is_failed() ) {
+		if ( autotune.is_finished() ) {
+			mode.set_pid_gains( autotune.get_kp(), autotune.get_ki(), autotune.get_kd() );
+			flow.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+			zones.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+		}
+		mode.set_current_mode(0);
+		autotune_ms = hal::millis();
+	}
+}
+
+
+void task_buttons()
+{
+	mode.control( buttons, buzzer );
+
+	if ( buzzer.is_pending() ) {
+		scheduler.trigger(TASK_BUZZER);
+	}
+}
+
+
+void task_buzzer()
+{
+	buzzer.service();
+}
+
+
+void task_telemetry()
+{
+	if ( !telemetry ) {
+		return;
+	}
+
+	telemetry_record record;
+	record.timestamp = hal::millis();
+	record.rtd = 0;
+	record.temp = current_temp_centi;
+	record.temp_barier = mode.get_temp_barier();
+	record.time_barier = mode.get_time_barier();
+	record.flags = (flow.get_heat_relay_state() ? TELEMETRY_HEAT : 0) | (flow.get_vent_relay_state() ? TELEMETRY_VENT : 0) |
+				   (flow.is_timer_started() ? TELEMETRY_TIMER : 0);
+	record.mode = mode.get_current_mode();
+	record.elapsed_time = flow.get_elapsed_time();
+	record.heat_duty = flow.get_heat_duty();
+
+	byte frame[TELEMETRY_FRAME_MAX];
+	fwrite(frame, 1, telemetry_encode(record, frame), telemetry);
+}
+
+
+// execute_command() of PID_controller.ino for the mode, parameter and recipe commands
+void execute_command( byte line, char *reply, size_t size )
+{
+	if ( line == COMMAND_TOO_LONG ) {
+		snprintf(reply, size, "err long");
+		return;
+	}
+
+	byte count = commands.get_count();
+	byte command = commands.find( 0, command_names, COMMAND_COUNT );
+	byte param = commands.find( 1, parameter_names, MODE_PARAM_COUNT );
+	int32_t value;
+
+	switch ( command ) {
+		case COMMAND_STATUS:
+			snprintf(reply, size, "ok mode %u temp %.2f setpoint %.2f segment %u elapsed %d duty %u fault 0 safety %u",
+					 mode.get_current_mode(), current_temp_centi / 100.0, flow.get_setpoint() / 100.0, flow.get_segment(),
+					 flow.get_elapsed_time(), flow.get_heat_duty(), safety.get_fault());
+			return;
+
+		case COMMAND_GET:
+			if ( count != 2 || param == MODE_PARAM_COUNT ) {
+				break;
+			}
+			snprintf(reply, size, "ok %d", (int)mode.get_parameter(param));
+			return;
+
+		case COMMAND_SET:
+			if ( count != 3 || param == MODE_PARAM_COUNT || !commands.get_number(2, value) ) {
+				break;
+			}
+			if ( mode.get_current_mode() != 0 ) {
+				snprintf(reply, size, "err mode");
+			} else if ( !mode.set_parameter(param, value) ) {
+				snprintf(reply, size, "err range");
+			} else {
+				if ( param >= MODE_PARAM_KP ) {
+					flow.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+					zones.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+				}
+				snprintf(reply, size, "ok");
+			}
+			return;
+
+		case COMMAND_START:
+		case COMMAND_ABORT:
+		case COMMAND_ACK: {
+			if ( count != 1 ) {
+				break;
+			}
+			byte request = command == COMMAND_START ? MODE_REQUEST_START : command == COMMAND_ABORT ? MODE_REQUEST_ABORT : MODE_REQUEST_ACK;
+			snprintf(reply, size, mode.request(request) ? "ok" : "err mode");
+			return;
+		}
+
+		case COMMAND_RECIPE: {
+			recipe program;
+			mode.get_recipe( program );
+			if ( !mode.has_recipe() ) {
+				program.count = 0;
+			}
+			if ( count == 1 ) {
+				snprintf(reply, size, "ok %u", program.count);
+				return;
+			}
+			bool clear = count == 2 && commands.find(1, clear_name, 1) == 0;
+
+			int32_t fields[5];
+			fields[4] = 0;
+			bool valid = clear || count == 2 || count == 5 || count == 6;
+			for ( byte i = 1; valid && !clear && i < count; ++i ) {
+				valid = commands.get_number(i, fields[i - 1]);
+			}
+			if ( !valid ) {
+				break;
+			}
+
+			if ( count == 2 && !clear ) {
+				if ( fields[0] < 1 || fields[0] > program.count ) {
+					snprintf(reply, size, "err range");
+					return;
+				}
+				const recipe_segment &segment = program.segments[fields[0] - 1];
+				snprintf(reply, size, "ok %u %u %u %u", segment.target, segment.rate, segment.hold, segment.flags);
+				return;
+			}
+
+			if ( mode.get_current_mode() != 0 ) {
+				snprintf(reply, size, "err mode");
+				return;
+			}
+			if ( clear ) {
+				program.count = 0;
+				mode.set_recipe( program );
+				snprintf(reply, size, "ok");
+				return;
+			}
+			bool in_range = fields[0] >= 1 && fields[0] <= RECIPE_MAX_SEGMENTS;
+			for ( byte i = 1; i < 5; ++i ) {
+				in_range = in_range && fields[i] >= 0 && fields[i] <= 255;
+			}
+			recipe_segment segment;
+			segment.target = fields[1];
+			segment.rate = fields[2];
+			segment.hold = fields[3];
+			segment.flags = fields[4];
+			snprintf(reply, size, in_range && mode.set_recipe_segment(fields[0] - 1, segment) ? "ok" : "err range");
+			return;
+		}
+
+		default:
+			snprintf(reply, size, "err unknown");   // the stream and report commands are not simulated
+			return;
+	}
+	snprintf(reply, size, "err syntax");
+}
+
+
+void task_serial()
+{
+	byte line = commands.poll(serial_in);
+	if ( line != COMMAND_NONE ) {
+		char reply[SERIAL_REPLY_MAX];
+		execute_command( line, reply, sizeof(reply) );
+		const sim_command &sent = sim_commands[command_next - 1];
+		printf("command           %.1f min, %.*s: %s\n", hal::millis() / 60000.0, (int)strcspn(sent.text, "\n"), sent.text, reply);
+	}
+}
+
+
+void task_eeprom()
+{
+	mode.eeprom_service();
+	cycles.service();
+}
+
+
+
+// "target:rate:hold[:flags],..." into a recipe
+bool parse_recipe( const char *text, recipe &program )
+{
+	program.count = 0;
+	while ( *text ) {
+		unsigned target, rate, hold, flags = 0;
+		int used = 0;
+		if ( program.count == RECIPE_MAX_SEGMENTS ||
+			 (sscanf(text, "%u:%u:%u:%u%n", &target, &rate, &hold, &flags, &used) != 4 &&
+			  sscanf(text, "%u:%u:%u%n", &target, &rate, &hold, &used) != 3) ||
+			 target > 255 || rate > 255 || hold > 255 || flags > 255 ) {
+			return false;
+		}
+		recipe_segment &segment = program.segments[program.count++];
+		segment.target = target;
+		segment.rate = rate;
+		segment.hold = hold;
+		segment.flags = flags;
+
+		text += used;
+		if ( *text == ',' ) {
+			++text;
+		} else if ( *text ) {
+			return false;
+		}
+	}
+	return program.count > 0;
+}
+
+
+int main( int argc, char **argv )
+{
+	int temp_barier = DEF_TEMP_BARIER;
+	int time_barier = DEF_TIME_BARIER;
+	uint32_t step_ms = DEF_SIM_STEP_MS;
+	const char *trace_path = NULL;
+	const char *telemetry_path = NULL;
+	const char *history_path = NULL;
+	bool print_kpis = false;
+	float door_minute = -1, door_seconds = 0, door_loss = DEF_DOOR_LOSS;
+	float load_minute = -1, load_mass = 0;
+	float fault_minute = -1;
+	double gains[3];
+	bool seed_gains = false;
+	bool run_autotune = false;
+	int repeat = 1;
+	int zone_count = 1;
+	recipe program;
+	program.count = 0;
+
+	int opt;
+	while ( (opt = getopt(argc, argv, "t:m:s:c:b:n:g:ar:R:z:H:d:l:F:S:k")) != -1 ) {
+		switch ( opt ) {
+			case 't': temp_barier = atoi(optarg); break;
+			case 'm': time_barier = atoi(optarg); break;
+			case 's': step_ms = atoi(optarg); break;
+			case 'c': trace_path = optarg; break;
+			case 'b': telemetry_path = optarg; break;
+			case 'H': history_path = optarg; break;
+			case 'k': print_kpis = true; break;
+			case 'd':
+				if ( sscanf(optarg, "%f:%f:%f", &door_minute, &door_seconds, &door_loss) < 2 ) {
+					fprintf(stderr, "-d expects minute:seconds[:loss]\n");
+					return 2;
+				}
+				break;
+			case 'l':
+				if ( sscanf(optarg, "%f:%f", &load_minute, &load_mass) != 2 ) {
+					fprintf(stderr, "-l expects minute:mass\n");
+					return 2;
+				}
+				break;
+			case 'F': {
+				char kind[16];
+				if ( sscanf(optarg, "%f:%15[a-z]:%d", &fault_minute, kind, &fault_zone) < 2 || fault_zone < 0 ||
+					 !(fault_kind = !strcmp(kind, "probe") ? FAULT_PROBE : !strcmp(kind, "freeze") ? FAULT_FREEZE :
+									!strcmp(kind, "weld") ? FAULT_WELD : !strcmp(kind, "open") ? FAULT_OPEN : FAULT_NONE) ) {
+					fprintf(stderr, "-F expects minute:probe|freeze|weld|open[:zone]\n");
+					return 2;
+				}
+				break;
+			}
+			case 'S': {
+				float minute;
+				int used = 0;
+				if ( command_count == SIM_COMMANDS || sscanf(optarg, "%f:%n", &minute, &used) != 1 || !used ||
+					 (command_count && minute < sim_commands[command_count - 1].minute) ) {
+					fprintf(stderr, "-S expects minute:command, up to %d in the order of time\n", SIM_COMMANDS);
+					return 2;
+				}
+				sim_command &command = sim_commands[command_count++];
+				command.minute = minute;
+				snprintf(command.text, sizeof(command.text), "%s\n", optarg + used);
+				break;
+			}
+			case 'n': noise_centi = atoi(optarg); break;
+			case 'g':
+				if ( sscanf(optarg, "%lf,%lf,%lf", &gains[0], &gains[1], &gains[2]) != 3 ) {
+					fprintf(stderr, "-g expects kp,ki,kd\n");
+					return 2;
+				}
+				seed_gains = true;
+				break;
+			case 'a': run_autotune = true; break;
+			case 'r': repeat = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+			case 'z':
+				zone_count = atoi(optarg);
+				if ( zone_count < 1 || zone_count > SIM_ZONES ) {
+					fprintf(stderr, "-z expects 1...%d zones\n", SIM_ZONES);
+					return 2;
+				}
+				break;
+			case 'R':
+				if ( !parse_recipe(optarg, program) ) {
+					fprintf(stderr, "-R expects up to %d segments target:rate:hold[:flags],...\n", RECIPE_MAX_SEGMENTS);
+					return 2;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t temp] [-m minutes] [-s step_ms] [-c trace.csv] [-b telemetry.bin] [-n noise_centi] [-g kp,ki,kd] [-a] [-r cycles]\n"
+						"          [-R target:rate:hold[:flags],...] [-z zones] [-H history.csv]\n"
+						"          [-d minute:seconds[:loss]] [-l minute:mass] [-F minute:fault] [-S minute:command] [-k]\n", argv[0]);
+				return 2;
+		}
+	}
+	if ( step_ms == 0 ) {
+		step_ms = 1;
+	}
+
+	FILE *trace = NULL;
+	if ( trace_path ) {
+		trace = fopen(trace_path, "w");
+		if ( !trace ) {
+			perror(trace_path);
+			return 1;
+		}
+		fprintf(trace, "time_s,temp,heat,vent,mode,elapsed_min\n");
+	}
+
+	if ( telemetry_path ) {
+		telemetry = fopen(telemetry_path, "wb");
+		if ( !telemetry ) {
+			perror(telemetry_path);
+			return 1;
+		}
+	}
+
+	if ( fault_zone >= zone_count ) {
+		fprintf(stderr, "-F zone %d is not one of the %d zones of -z\n", fault_zone, zone_count);
+		return 2;
+	}
+
+	clock_t wall_start = clock();
+
+	sim::reset();
+
+	oven_model plant;
+	ovens[0] = &plant;
+	for ( int zone = 1; zone < SIM_ZONES; ++zone ) {
+		// every further chamber has less heater power and more thermal mass
+		ovens[zone] = zone < zone_count ? new oven_model(DEF_OVEN_AMBIENT, DEF_OVEN_GAIN * (1 - 0.05f * zone),
+														 DEF_OVEN_TIME_CONSTANT * (1 + 0.15f * zone)) : NULL;
+	}
+
+	// mode.init() loads the parameters from the erased EEPROM (defaults), then the options apply
+	buttons.init();
+	mode.init();
+	cycles.init();
+	safety.set_model( 0, &flow.get_model() );
+	safety.init();
+	mode.set_temp_barier(temp_barier);
+	mode.set_time_barier(time_barier);
+	if ( seed_gains ) {
+		mode.set_pid_gains( Q16(gains[0]), Q16(gains[1]), Q16(gains[2]) );
+	}
+	if ( program.count && !mode.set_recipe(program) ) {
+		fprintf(stderr, "-R recipe out of range\n");
+		return 2;
+	}
+	flow.init();
+	flow.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+	zones.init();
+	zones.set_pid_gains( mode.get_pid_kp(), mode.get_pid_ki(), mode.get_pid_kd() );
+	buzzer.init();
+
+	scheduler.add( task_sensor,  TASK_SENSOR_MS );
+	scheduler.add( task_control, TASK_CONTROL_MS );
+	scheduler.add( task_buttons, TASK_BUTTONS_MS );
+	scheduler.add( task_buzzer,  TASK_ON_DEMAND );
+	scheduler.add( task_telemetry, TASK_TELEMETRY_MS );
+	scheduler.add( task_serial,  TASK_SERIAL_MS );
+	scheduler.add( task_eeprom,  TASK_EEPROM_MS );
+	idle.init();
+	byte button_port = gpio_pin<PIN_BUTTON_PLUS>::read_port();
+	uint32_t idle_ms = 0;                 // time spent in the low-power idle
+
+	temp_barier = mode.get_temp_barier();
+	time_barier = mode.get_time_barier();
+	if ( mode.has_recipe() ) {
+		// statistics against the highest target, the time limit covers all holds
+		temp_barier = recipe_peak_target(program);
+		time_barier = recipe_total_hold(program);
+	}
+
+	// cycle statistics
+	uint32_t setpoint_reached_ms = 0;
+	float peak_temp = plant.temperature();
+	float zone_peak[SIM_ZONES] = { 0 };   // followers, after zone 0 reached the setpoint
+	unsigned long heat_switches = 0;
+	uint32_t heat_on_ms = 0;
+	bool last_heat = false;
+	float start_temp = plant.temperature();
+	uint32_t rise_10_ms = 0;              // 10 % and 90 % of the way from the start to the setpoint
+	uint32_t rise_90_ms = 0;
+	uint32_t hold_ms = 0;                 // holding, and within SETTLE_BAND of the setpoint while holding
+	uint32_t in_band_ms = 0;
+	uint32_t last_outside_ms = 0;         // last time out of the band while holding
+	bool load_added = false;
+	uint32_t safety_ms = 0;               // first trip of the safety monitor
+	byte safety_fault = SAFETY_OK;
+	byte safety_zone = 0;
+
+	int cycles_done = 0;
+	uint32_t press_at_ms = START_PRESS_AT_MS;   // next START press, cycles after the first wait for the oven to cool
+	uint32_t cycle_start_ms = press_at_ms;
+
+	const uint32_t limit_ms = (uint32_t(time_barier) + 180 + (repeat - 1) * (time_barier + 300)) * 60000UL;
+
+	for ( uint32_t now = 0; now < limit_ms; now += step_ms ) {
+		if ( run_autotune ) {
+			bool combo = now >= START_PRESS_AT_MS && now < START_PRESS_AT_MS + COMBO_PRESS_MS;
+			sim::set_button(PIN_BUTTON_PLUS, combo);
+			sim::set_button(PIN_BUTTON_MINUS, combo);
+		} else {
+			if ( !press_at_ms && plant.temperature() < plant.ambient() + COOLED_MARGIN ) {
+				press_at_ms = now + START_PRESS_AT_MS;
+				cycle_start_ms = press_at_ms;
+				start_temp = plant.temperature();
+				load_added = false;
+			}
+			sim::set_button(PIN_BUTTON_START, press_at_ms && now >= press_at_ms && now < press_at_ms + START_PRESS_MS);
+		}
+
+		// the next command line once the last one is taken
+		if ( command_next < command_count && !serial_in.available() && now >= uint32_t(sim_commands[command_next].minute * 60000) ) {
+			serial_in.rx = sim_commands[command_next++].text;
+		}
+
+		// pin change interrupt of the buttons
+		if ( gpio_pin<PIN_BUTTON_PLUS>::read_port() != button_port ) {
+			button_port = gpio_pin<PIN_BUTTON_PLUS>::read_port();
+			idle.pin_change();
+		}
+
+		// Timer1 interrupt of PID_controller.ino, stopped in the idle, then loop(), all due tasks get their turn within the step
+		for ( uint32_t tick = (now + HEATER_TICK_MS - 1) / HEATER_TICK_MS; tick * HEATER_TICK_MS < now + step_ms && !idle.is_idle(); ++tick ) {
+			flow.heater_tick();
+			zones.heater_tick();
+		}
+		byte current_mode = mode.get_current_mode();
+		byte change = idle.update( (current_mode == 0 || current_mode == 1) && !buttons.get_state() );
+		if ( change != IDLE_NONE ) {
+			bool idling = change == IDLE_ENTER;
+			scheduler.set_period( TASK_SENSOR,    idling ? IDLE_TASK_MS : TASK_SENSOR_MS );
+			scheduler.set_period( TASK_CONTROL,   idling ? IDLE_TASK_MS : TASK_CONTROL_MS );
+			scheduler.set_period( TASK_BUTTONS,   idling ? TASK_ON_DEMAND : TASK_BUTTONS_MS );
+			scheduler.set_period( TASK_TELEMETRY, idling ? IDLE_TASK_MS : TASK_TELEMETRY_MS );
+		}
+		if ( idle.is_idle() ) {
+			idle_ms += step_ms;
+		}
+		while ( scheduler.run() ) {
+		}
+
+		bool heat = sim::pin_level(PIN_RELAY_HEAT);
+		bool vent = sim::pin_level(PIN_RELAY_VENT);
+
+		if ( heat != last_heat ) {
+			++heat_switches;
+			last_heat = heat;
+		}
+		if ( heat ) {
+			heat_on_ms += step_ms;
+		}
+
+		if ( trace && now % 1000 < step_ms ) {
+			fprintf(trace, "%u,%.2f,%d,%d,%d,%d\n", now / 1000, plant.temperature(), heat, vent,
+					mode.get_current_mode(), flow.get_elapsed_time());
+		}
+
+		// disturbances, from the start of each cycle
+		if ( door_minute >= 0 ) {
+			uint32_t door_ms = cycle_start_ms + uint32_t(door_minute * 60000);
+			plant.set_loss( now >= door_ms && now < door_ms + uint32_t(door_seconds * 1000) ? door_loss : 1.0f );
+		}
+		if ( load_minute >= 0 && !load_added && now >= cycle_start_ms + uint32_t(load_minute * 60000) ) {
+			plant.add_load(load_mass);
+			load_added = true;
+		}
+		uint32_t fault_ms = cycle_start_ms + uint32_t(fault_minute * 60000);
+		if ( fault_kind && !fault_active && now >= fault_ms ) {
+			fault_active = true;
+			fault_frozen_temp = int( ovens[fault_zone]->temperature() * 100 );
+			fault_start_ms = now;
+		}
+
+		for ( int zone = 0; zone < zone_count; ++zone ) {
+			bool zone_heat = zone ? sim::pin_level(pgm_read_byte(zone_heat_pins + zone - 1)) : heat;
+			if ( fault_active && zone == fault_zone && fault_kind == FAULT_WELD ) {
+				zone_heat = true;
+			} else if ( fault_active && zone == fault_zone && fault_kind == FAULT_OPEN ) {
+				zone_heat = false;
+			}
+			ovens[zone]->step(zone_heat, step_ms);
+			if ( zone && setpoint_reached_ms && ovens[zone]->temperature() > zone_peak[zone] ) {
+				zone_peak[zone] = ovens[zone]->temperature();
+			}
+		}
+		sim::advance(step_ms);
+
+		if ( press_at_ms && !setpoint_reached_ms && plant.temperature() >= temp_barier ) {
+			setpoint_reached_ms = now;
+		}
+		if ( setpoint_reached_ms && plant.temperature() > peak_temp ) {
+			peak_temp = plant.temperature();
+		}
+		if ( press_at_ms && now >= press_at_ms ) {
+			float rise = (plant.temperature() - start_temp) / (temp_barier - start_temp);
+			if ( !rise_10_ms && rise >= 0.1f ) {
+				rise_10_ms = now;
+			}
+			if ( !rise_90_ms && rise >= 0.9f ) {
+				rise_90_ms = now;
+			}
+		}
+		if ( flow.is_timer_started() ) {
+			hold_ms += step_ms;
+			if ( fabsf(plant.temperature() - flow.get_setpoint() / 100.0f) <= SETTLE_BAND ) {
+				in_band_ms += step_ms;
+			} else {
+				last_outside_ms = now;
+			}
+		}
+		if ( autotune_ms ) {
+			break;
+		}
+		if ( safety.get_fault() && !safety_ms ) {
+			safety_ms = now;
+			safety_fault = safety.get_fault();
+			safety_zone = safety.get_fault_zone();
+			if ( fault_active && command_next == command_count ) {
+				break;   // the injected fault was found
+			}
+		}
+		if ( finished_ms ) {
+			if ( ++cycles_done == repeat ) {
+				break;
+			}
+			printf("cycle %-2d          %.1f min to setpoint, %.2f C overshoot\n", cycles_done,
+				   setpoint_reached_ms ? (setpoint_reached_ms - cycle_start_ms) / 60000.0 : 0.0, peak_temp - temp_barier);
+			finished_ms = 0;
+			setpoint_reached_ms = 0;
+			peak_temp = plant.temperature();
+			press_at_ms = 0;
+			rise_10_ms = 0;
+			rise_90_ms = 0;
+			hold_ms = 0;
+			in_band_ms = 0;
+			last_outside_ms = 0;
+		}
+	}
+
+	double wall_s = double(clock() - wall_start) / CLOCKS_PER_SEC;
+
+	if ( trace ) {
+		fclose(trace);
+	}
+	if ( history_path ) {
+		FILE *out = fopen(history_path, "w");
+		if ( !out ) {
+			perror(history_path);
+			return 1;
+		}
+		fprintf(out, "time_s,temp,duty\n");
+		history_reader reader;
+		history.rewind(reader);
+		int16_t temp;
+		byte duty;
+		for ( uint32_t t = 0; history.next(reader, temp, duty); t += history.get_interval() / 1000 ) {
+			fprintf(out, "%u,%.1f,%u\n", t, temp / 10.0, duty);
+		}
+		fclose(out);
+	}
+	if ( telemetry ) {
+		fclose(telemetry);
+	}
+
+	if ( run_autotune ) {
+		const relay_autotune &autotune = flow.get_autotune();
+		printf("setpoint          %d C\n", temp_barier);
+		if ( !autotune.is_finished() ) {
+			printf("autotune          failed after %.1f min\n", (autotune_ms ? autotune_ms : limit_ms) / 60000.0);
+			return 1;
+		}
+		printf("autotune          %.1f min, %u cycles\n", autotune_ms / 60000.0, autotune.get_cycles());
+		printf("ultimate gain     %.4f counts/centi-degree\n", autotune.get_ku() / 65536.0);
+		printf("ultimate period   %.1f s\n", autotune.get_tu() / 1000.0);
+		printf("PID gains         -g %.4f,%.6f,%.4f\n", mode.get_pid_kp() / 65536.0, mode.get_pid_ki() / 65536.0,
+			   mode.get_pid_kd() / 65536.0);
+		printf("wall time         %.3f s\n", wall_s);
+		return 0;
+	}
+
+	printf("setpoint          %d C, hold %d min\n", temp_barier, time_barier);
+	if ( setpoint_reached_ms ) {
+		printf("time to setpoint  %.1f min\n", (setpoint_reached_ms - cycle_start_ms) / 60000.0);
+		printf("overshoot         %.2f C\n", peak_temp - temp_barier);
+	} else {
+		printf("time to setpoint  not reached\n");
+	}
+	if ( finished_ms ) {
+		printf("cycle finished    %.1f min\n", (finished_ms - cycle_start_ms) / 60000.0);
+	} else {
+		printf("cycle finished    no (gave up after %u min)\n", limit_ms / 60000);
+	}
+	if ( flow.get_model().is_valid() ) {
+		printf("oven model        tau %d s, gain %.1f C\n", flow.get_model().get_time_constant(), flow.get_model().get_gain() / 100.0);
+	}
+	for ( int zone = 1; zone < zone_count; ++zone ) {
+		printf("zone %d            %.2f C overshoot, %.1f C at the end\n", zone, zone_peak[zone] - temp_barier, ovens[zone]->temperature());
+	}
+	if ( history.get_count() ) {
+		printf("run history       %u samples every %u s in %u bytes\n", history.get_count(),
+			   (unsigned)(history.get_interval() / 1000), history.get_size());
+	}
+	while ( cycles.is_busy() ) {
+		cycles.service();   // the summary of a cycle that just ended
+	}
+	cycle_summary summary;
+	if ( cycles.read(0, summary) ) {
+		printf("cycle log         result %u, peak %.2f C, arrival %u s, %u s, heater %u %%\n", summary.result,
+			   summary.peak_temp / 100.0, summary.arrival, summary.duration, summary.heater_percent);
+	}
+	if ( fault_active ) {
+		printf("injected fault    %s in zone %d at %.1f min, %s\n", fault_kind == FAULT_PROBE ? "probe" : fault_kind == FAULT_FREEZE ? "freeze" :
+			   fault_kind == FAULT_WELD ? "weld" : "open",
+			   fault_zone, fault_minute, safety_ms ? "found" : "not found");
+	}
+	if ( safety_ms ) {
+		printf("safety fault      %u in zone %u after %.1f min%s\n", safety_fault, safety_zone, (safety_ms - cycle_start_ms) / 60000.0,
+			   fault_active ? "" : ", no fault injected");
+		if ( fault_active ) {
+			printf("detection time    %.1f s\n", (safety_ms - cycle_start_ms) / 1000.0 - fault_minute * 60);
+		}
+	}
+	if ( idle_ms ) {
+		printf("low-power idle    %.1f min\n", idle_ms / 60000.0);
+	}
+	printf("filter delay      %u ms\n", (unsigned)(zones.group_delay() * TASK_SENSOR_MS / FILTER_DELAY_ONE));
+	printf("heater switches   %lu\n", heat_switches);
+	printf("heater on time    %.1f min\n", heat_on_ms / 60000.0);
+	printf("buzzer tones      %u\n", sim::tone_count());
+	printf("wall time         %.3f s\n", wall_s);
+
+	if ( print_kpis ) {
+		// of the last cycle; times in minutes, a band never left counts as settled at the arrival
+		uint32_t settled_ms = last_outside_ms > setpoint_reached_ms ? last_outside_ms : setpoint_reached_ms;
+		printf("kpi overshoot %.2f\n", setpoint_reached_ms ? peak_temp - temp_barier : 0.0f);
+		printf("kpi rise_time %.2f\n", rise_90_ms ? (rise_90_ms - rise_10_ms) / 60000.0 : -1.0);
+		printf("kpi time_to_setpoint %.2f\n", setpoint_reached_ms ? (setpoint_reached_ms - cycle_start_ms) / 60000.0 : -1.0);
+		printf("kpi settling_time %.2f\n", setpoint_reached_ms ? (settled_ms - cycle_start_ms) / 60000.0 : -1.0);
+		printf("kpi time_in_band %.2f\n", hold_ms ? 100.0 * in_band_ms / hold_ms : 0.0);
+		printf("kpi heater_switches %lu\n", heat_switches);
+		printf("kpi heater_energy %.2f\n", heat_on_ms / 60000.0);
+		printf("kpi cycle_time %.2f\n", finished_ms ? (finished_ms - cycle_start_ms) / 60000.0 : -1.0);
+	}
+
+	return finished_ms ? 0 : 1;
+}
@@ -0,0 +1,444 @@
+// PID gain sweep.
+// Runs the closed loop of the sketch, sensor filter, flow_control with its
+// heater output and the oven model, once for every point of a kp x ki x kd x
+// heater window x IIR shift grid and prints the Pareto front of time to
+// setpoint, overshoot and heater relay switches: the settings no other set
+// beats in all three at once.
+//
+//   make -C host sweep && host/sweep [-t temp] [-m minutes] [-j threads] [-p min:max:steps] [-i min:max:steps]
+//                                    [-d min:max:steps] [-w min:max:steps] [-f min:max] [-c results.csv] [-s]
+//
+// -p, -i, -d give the kp, ki and kd ranges, spaced geometrically; a range
+// from 0 has 0 and then steps halving down from the maximum. -w gives the
+// heater window in ms, spaced geometrically and rounded to HEATER_TICK_MS
+// (flow_control::set_heat_window()), -f the shifts of the IIR stage of the
+// sensor filter, every one from min to max; the sketch's HEAT_WINDOW_MS and
+// shift 3 by default. The simulations
+// run on a work-stealing pool of -j threads, all cores by default: every
+// worker takes the grid points of its own queue from the back and, when it
+// runs dry, steals from the front of another, so the long runs of slow gain
+// sets spread over all cores. Each simulation owns its controller and a
+// simulated board of its own (sim_hal.cpp is per thread), nothing is shared
+// but the queues. -s runs the grid on 1, 2, 4... up to -j threads first and
+// prints the wall time and the speedup of each.
+//
+// The loop steps HEATER_TICK_MS and leaves out mode_control, the buttons and
+// the zones; a gain set from the front is worth a run of host/simulator -g.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sim.hpp"
+#include "oven_model.hpp"
+#include "../mode_control.hpp"
+#include "../flow_control.hpp"
+#include "../sensor_filter.hpp"
+
+#define PIN_RELAY_HEAT     6
+#define PIN_RELAY_VENT     7
+
+#define TASK_SENSOR_MS     20
+#define TASK_CONTROL_MS    100
+#define SWEEP_EXTRA_MIN    180       // heat-up allowance on top of the hold, as in the simulator
+#define SWEEP_SHIFT_MAX    6         // IIR shifts of -f, time constant up to 64 samples
+
+typedef flow_control< gpio_pin<PIN_RELAY_HEAT>, gpio_pin<PIN_RELAY_VENT> > oven_flow;
+
+
+struct gain_range
+{
+	double min;
+	double max;
+	int steps;
+};
+
+
+struct sweep_point
+{
+	double kp, ki, kd;
+	int window_ms;               // heater time-proportioning window
+	int iir_shift;               // of the sensor filter
+
+	// results
+	bool reached;
+	bool finished;
+	double time_to_setpoint;     // min
+	double overshoot;            // C
+	unsigned long switches;      // heater relay
+	bool pareto;
+};
+
+
+/////////////////////////////////////////////////////////////// one closed-loop run
+
+// the filter of PID_controller.ino with the IIR shift of the point
+template <byte SHIFT>
+static void simulate_filter( sweep_point &p, int temp_barier, int time_barier )
+{
+	sim::reset();
+
+	recipe program;
+	recipe_single( program, temp_barier, time_barier );
+
+	oven_model plant;
+	filter_chain< median_filter<5>, filter_chain< iir_filter<SHIFT>, no_filter > > filter;
+	oven_flow flow;
+	flow.init();
+	flow.set_pid_gains( Q16(p.kp), Q16(p.ki), Q16(p.kd) );
+	flow.set_heat_window( p.window_ms );
+
+	int temp = int( plant.temperature() * 100 );
+	filter.reset( temp );
+
+	uint32_t reached_ms = 0;
+	float peak = plant.temperature();
+	unsigned long switches = 0;
+	bool last_heat = false;
+
+	const uint32_t limit_ms = uint32_t(time_barier + SWEEP_EXTRA_MIN) * 60000UL;
+	uint32_t now = 0;
+	for ( ; now < limit_ms; now += HEATER_TICK_MS ) {
+		if ( now % TASK_SENSOR_MS == 0 ) {
+			temp = filter.update( int( plant.temperature() * 100 ) );
+		}
+		if ( now % TASK_CONTROL_MS == 0 ) {
+			flow.control( 2, temp, program );
+			if ( flow.is_operation_finished() ) {
+				break;
+			}
+		}
+		flow.heater_tick();
+
+		bool heat = sim::pin_level(PIN_RELAY_HEAT);
+		if ( heat != last_heat ) {
+			++switches;
+			last_heat = heat;
+		}
+		plant.step( heat, HEATER_TICK_MS );
+		sim::advance( HEATER_TICK_MS );
+
+		if ( !reached_ms && plant.temperature() >= temp_barier ) {
+			reached_ms = now;
+		}
+		if ( reached_ms && plant.temperature() > peak ) {
+			peak = plant.temperature();
+		}
+	}
+
+	p.reached = reached_ms != 0;
+	p.finished = now < limit_ms;
+	// at the printed resolution, a few ms sooner is no better
+	p.time_to_setpoint = floor(reached_ms / 6000.0 + 0.5) / 10;
+	p.overshoot = reached_ms ? floor((peak - temp_barier) * 100 + 0.5) / 100 : 0.0;
+	p.switches = switches;
+}
+
+
+static void simulate( sweep_point &p, int temp_barier, int time_barier )
+{
+	switch ( p.iir_shift ) {
+		case 0: simulate_filter<0>( p, temp_barier, time_barier ); break;
+		case 1: simulate_filter<1>( p, temp_barier, time_barier ); break;
+		case 2: simulate_filter<2>( p, temp_barier, time_barier ); break;
+		case 3: simulate_filter<3>( p, temp_barier, time_barier ); break;
+		case 4: simulate_filter<4>( p, temp_barier, time_barier ); break;
+		case 5: simulate_filter<5>( p, temp_barier, time_barier ); break;
+		default: simulate_filter<SWEEP_SHIFT_MAX>( p, temp_barier, time_barier ); break;
+	}
+}
+
+
+/////////////////////////////////////////////////////////////// work-stealing pool
+
+struct work_queue
+{
+	std::mutex lock;
+	std::deque<size_t> tasks;    // grid point indices
+};
+
+
+struct sweep_job
+{
+	std::vector<sweep_point> *points;
+	std::vector<work_queue> *queues;
+	int temp_barier;
+	int time_barier;
+	unsigned long steals;
+	std::mutex steals_lock;
+};
+
+
+static bool take_own( work_queue &queue, size_t &task )
+{
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if ( queue.tasks.empty() ) {
+		return false;
+	}
+	task = queue.tasks.back();
+	queue.tasks.pop_back();
+	return true;
+}
+
+
+static bool steal( work_queue &queue, size_t &task )
+{
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if ( queue.tasks.empty() ) {
+		return false;
+	}
+	task = queue.tasks.front();
+	queue.tasks.pop_front();
+	return true;
+}
+
+
+static void worker( sweep_job *job, size_t self )
+{
+	std::vector<work_queue> &queues = *job->queues;
+	unsigned long stolen = 0;
+
+	for ( ;; ) {
+		size_t task;
+		bool found = take_own(queues[self], task);
+		// no task is ever added, all queues empty means the sweep is done
+		for ( size_t i = 1; !found && i < queues.size(); ++i ) {
+			found = steal(queues[(self + i) % queues.size()], task);
+			stolen += found;
+		}
+		if ( !found ) {
+			break;
+		}
+		simulate( (*job->points)[task], job->temp_barier, job->time_barier );
+	}
+
+	std::lock_guard<std::mutex> guard(job->steals_lock);
+	job->steals += stolen;
+}
+
+
+// Every point on a pool of threads, returns the wall time in s
+static double run_pool( std::vector<sweep_point> &points, unsigned threads, int temp_barier, int time_barier,
+						unsigned long &steals )
+{
+	// contiguous blocks, neighbouring gain sets take alike long, the stealing evens it out
+	std::vector<work_queue> queues(threads);
+	for ( size_t i = 0; i < points.size(); ++i ) {
+		queues[i * threads / points.size()].tasks.push_back(i);
+	}
+
+	sweep_job job;
+	job.points = &points;
+	job.queues = &queues;
+	job.temp_barier = temp_barier;
+	job.time_barier = time_barier;
+	job.steals = 0;
+
+	std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for ( unsigned t = 0; t < threads; ++t ) {
+		pool.push_back(std::thread(worker, &job, t));
+	}
+	for ( unsigned t = 0; t < threads; ++t ) {
+		pool[t].join();
+	}
+	steals = job.steals;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+}
+
+
+/////////////////////////////////////////////////////////////// Pareto front
+
+// a is at least as good as b in every objective and better in one
+static bool dominates( const sweep_point &a, const sweep_point &b )
+{
+	bool better = a.time_to_setpoint < b.time_to_setpoint || a.overshoot < b.overshoot || a.switches < b.switches;
+	return better && a.time_to_setpoint <= b.time_to_setpoint && a.overshoot <= b.overshoot && a.switches <= b.switches;
+}
+
+
+static void mark_pareto( std::vector<sweep_point> &points )
+{
+	for ( size_t i = 0; i < points.size(); ++i ) {
+		sweep_point &p = points[i];
+		p.pareto = p.reached && p.finished;
+		for ( size_t j = 0; p.pareto && j < points.size(); ++j ) {
+			const sweep_point &q = points[j];
+			if ( j != i && q.reached && q.finished && dominates(q, p) ) {
+				p.pareto = false;
+			}
+		}
+	}
+}
+
+
+/////////////////////////////////////////////////////////////// main
+
+static bool parse_range( const char *text, gain_range &range )
+{
+	return sscanf(text, "%lf:%lf:%d", &range.min, &range.max, &range.steps) == 3 && range.steps >= 1 &&
+		   range.min >= 0 && range.max >= range.min && (range.min > 0 || range.steps >= 2 || range.max == 0);
+}
+
+
+static double range_value( const gain_range &range, int i )
+{
+	if ( range.steps == 1 ) {
+		return range.min;
+	}
+	if ( range.min == 0 ) {
+		// 0, then halving down from max
+		return i == 0 ? 0 : range.max * pow(0.5, range.steps - 1 - i);
+	}
+	return range.min * pow(range.max / range.min, double(i) / (range.steps - 1));
+}
+
+
+int main( int argc, char **argv )
+{
+	int temp_barier = DEF_TEMP_BARIER;
+	int time_barier = DEF_TIME_BARIER;
+	unsigned threads = std::thread::hardware_concurrency();
+	const char *csv_path = NULL;
+	gain_range kp = { 0.05, 1.0, 8 };
+	gain_range ki = { 0.0005, 0.01, 8 };
+	gain_range kd = { 0.0, 20.0, 6 };
+	gain_range window = { HEAT_WINDOW_MS, HEAT_WINDOW_MS, 1 };
+	int shift_min = 3, shift_max = 3;
+	bool scaling = false;
+
+	int opt;
+	while ( (opt = getopt(argc, argv, "t:m:j:p:i:d:w:f:c:s")) != -1 ) {
+		bool valid = true;
+		switch ( opt ) {
+			case 't': temp_barier = atoi(optarg); break;
+			case 'm': time_barier = atoi(optarg); break;
+			case 'j': threads = atoi(optarg); break;
+			case 'p': valid = parse_range(optarg, kp); break;
+			case 'i': valid = parse_range(optarg, ki); break;
+			case 'd': valid = parse_range(optarg, kd); break;
+			case 'w':
+				valid = parse_range(optarg, window) && window.min >= HEATER_TICK_MS &&
+						window.max <= (double)HEATER_WINDOW_MAX * HEATER_TICK_MS;
+				break;
+			case 'f':
+				valid = sscanf(optarg, "%d:%d", &shift_min, &shift_max) == 2 && shift_min >= 0 &&
+						shift_max >= shift_min && shift_max <= SWEEP_SHIFT_MAX;
+				break;
+			case 'c': csv_path = optarg; break;
+			case 's': scaling = true; break;
+			default: valid = false; break;
+		}
+		if ( !valid ) {
+			fprintf(stderr, "usage: %s [-t temp] [-m minutes] [-j threads] [-p min:max:steps] [-i min:max:steps]\n"
+					"          [-d min:max:steps] [-w min:max:steps] [-f min:max] [-c results.csv] [-s]\n"
+					"-w expects %d...%d ms, -f shifts 0...%d\n", argv[0], HEATER_TICK_MS,
+					HEATER_WINDOW_MAX * HEATER_TICK_MS, SWEEP_SHIFT_MAX);
+			return 2;
+		}
+	}
+	if ( temp_barier < 1 || temp_barier > 255 || time_barier < 1 || time_barier > 255 ) {
+		fprintf(stderr, "-t and -m expect 1...255\n");
+		return 2;
+	}
+	if ( threads < 1 ) {
+		threads = 1;
+	}
+
+	std::vector<sweep_point> points;
+	for ( int i = 0; i < kp.steps; ++i ) {
+		for ( int j = 0; j < ki.steps; ++j ) {
+			for ( int k = 0; k < kd.steps; ++k ) {
+				for ( int w = 0; w < window.steps; ++w ) {
+					for ( int f = shift_min; f <= shift_max; ++f ) {
+						sweep_point p = sweep_point();
+						p.kp = range_value(kp, i);
+						p.ki = range_value(ki, j);
+						p.kd = range_value(kd, k);
+						p.window_ms = int(range_value(window, w) / HEATER_TICK_MS + 0.5) * HEATER_TICK_MS;
+						p.iir_shift = f;
+						points.push_back(p);
+					}
+				}
+			}
+		}
+	}
+	if ( threads > points.size() ) {
+		threads = points.size();
+	}
+
+	// with -s the same grid on 1, 2, 4... threads first, the results of the last run are kept
+	if ( scaling ) {
+		printf("%-9s %10s %14s %8s %10s\n", "threads", "wall", "simulations/s", "speedup", "efficiency");
+	}
+	unsigned long steals = 0;
+	double wall_s = 0, single_s = 0;
+	for ( unsigned t = scaling ? 1 : threads; ; t = t * 2 < threads ? t * 2 : threads ) {
+		wall_s = run_pool(points, t, temp_barier, time_barier, steals);
+		if ( t == 1 ) {
+			single_s = wall_s;
+		}
+		if ( scaling ) {
+			printf("%-9u %8.2f s %14.1f %7.2fx %9.0f %%\n", t, wall_s, points.size() / wall_s, single_s / wall_s,
+				   100 * single_s / wall_s / t);
+		}
+		if ( t == threads ) {
+			break;
+		}
+	}
+	if ( scaling ) {
+		printf("cores             %u\n", std::thread::hardware_concurrency());
+	}
+
+	mark_pareto(points);
+
+	if ( csv_path ) {
+		FILE *out = fopen(csv_path, "w");
+		if ( !out ) {
+			perror(csv_path);
+			return 1;
+		}
+		fprintf(out, "kp,ki,kd,window_ms,iir_shift,time_to_setpoint,overshoot,heater_switches,finished,pareto\n");
+		for ( size_t i = 0; i < points.size(); ++i ) {
+			const sweep_point &p = points[i];
+			fprintf(out, "%.4f,%.6f,%.4f,%d,%d,%.2f,%.2f,%lu,%d,%d\n", p.kp, p.ki, p.kd, p.window_ms, p.iir_shift,
+					p.reached ? p.time_to_setpoint : -1.0, p.overshoot, p.switches, p.finished, p.pareto);
+		}
+		fclose(out);
+	}
+
+	// the front by time to setpoint, then overshoot
+	std::vector<const sweep_point *> front;
+	for ( size_t i = 0; i < points.size(); ++i ) {
+		const sweep_point &p = points[i];
+		if ( p.pareto ) {
+			size_t at = front.size();
+			while ( at && (front[at - 1]->time_to_setpoint > p.time_to_setpoint ||
+						   (front[at - 1]->time_to_setpoint == p.time_to_setpoint && front[at - 1]->overshoot > p.overshoot)) ) {
+				--at;
+			}
+			front.insert(front.begin() + at, &p);
+		}
+	}
+
+	printf("setpoint          %d C, hold %d min\n", temp_barier, time_barier);
+	printf("simulations       %u on %u threads, %lu stolen\n", (unsigned)points.size(), threads, steals);
+	printf("wall time         %.2f s, %.1f simulations/s\n", wall_s, points.size() / wall_s);
+	printf("pareto front      %u settings\n", (unsigned)front.size());
+	printf("  %-28s %9s %5s %10s %10s %9s\n", "gains", "window", "shift", "setpoint", "overshoot", "switches");
+	for ( size_t i = 0; i < front.size(); ++i ) {
+		const sweep_point &p = *front[i];
+		char gains[64];
+		snprintf(gains, sizeof gains, "-g %.4f,%.6f,%.4f", p.kp, p.ki, p.kd);
+		printf("  %-28s %6d ms %5d %6.1f min %8.2f C %9lu\n", gains, p.window_ms, p.iir_shift, p.time_to_setpoint,
+			   p.overshoot, p.switches);
+	}
+
+	return front.empty() ? 1 : 0;
+}
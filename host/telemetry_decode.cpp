@@ -0,0 +1,93 @@
+// Telemetry stream decoder: reads the binary stream of the controller
+// (serial capture or file) and writes one CSV row per valid frame.
+// Anything between delimiters that is not a valid frame is printed to
+// stderr when it is text (profiling reports) and counted otherwise.
+//
+//   stty -F /dev/ttyUSB0 115200 raw && host/telemetry_decode /dev/ttyUSB0 > run.csv
+//   host/telemetry_decode capture.bin > run.csv
+
+#include <stdio.h>
+#include <ctype.h>
+
+#include "../telemetry.hpp"
+
+#define MAX_CHUNK  255
+
+
+static unsigned long frames = 0;
+static unsigned long bad_frames = 0;
+
+
+static void print_text( const byte *chunk, size_t length )
+{
+	for ( size_t i = 0; i < length; ++i ) {
+		if ( !isprint(chunk[i]) && chunk[i] != '\r' && chunk[i] != '\n' ) {
+			++bad_frames;
+			return;
+		}
+	}
+	fwrite(chunk, 1, length, stderr);
+}
+
+
+static void handle_chunk( const byte *chunk, size_t length )
+{
+	telemetry_record r;
+
+	if ( length == 0 ) {
+		return;
+	}
+	if ( length > 0xFF || !telemetry_decode(chunk, length, r) ) {
+		print_text(chunk, length);
+		return;
+	}
+
+	++frames;
+	printf("%u,%u,%.2f,%u,%u,%d,%d,%d,%d,%u,%u,%u\n", r.timestamp, r.rtd, r.temp / 100.0, r.temp_barier, r.time_barier,
+		   !!(r.flags & TELEMETRY_HEAT), !!(r.flags & TELEMETRY_VENT), !!(r.flags & TELEMETRY_TIMER), !!(r.flags & TELEMETRY_FAULT),
+		   r.mode, r.elapsed_time, r.heat_duty);
+	fflush(stdout);   // live capture from a serial port
+}
+
+
+int main( int argc, char **argv )
+{
+	FILE *in = stdin;
+	if ( argc > 1 ) {
+		in = fopen(argv[1], "rb");
+		if ( !in ) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	printf("time_ms,rtd,temp,temp_barier,time_barier,heat,vent,timer,fault,mode,elapsed_min,heat_duty\n");
+
+	byte chunk[MAX_CHUNK];
+	size_t length = 0;
+	bool overflow = false;
+	int c;
+
+	while ( (c = fgetc(in)) != EOF ) {
+		if ( c == 0 ) {
+			if ( overflow ) {
+				++bad_frames;
+			} else {
+				handle_chunk(chunk, length);
+			}
+			length = 0;
+			overflow = false;
+		} else if ( length < MAX_CHUNK ) {
+			chunk[length++] = c;
+		} else {
+			overflow = true;
+		}
+	}
+
+	fprintf(stderr, "%lu frames, %lu invalid\n", frames, bad_frames);
+
+	if ( in != stdin ) {
+		fclose(in);
+	}
+	return 0;
+}
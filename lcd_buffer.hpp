@@ -0,0 +1,171 @@
+#ifndef LCD_BUFFER_HPP
+#define LCD_BUFFER_HPP
+
+#include <Wire.h>
+
+// 16x2 shadow framebuffer for the I2C 1602 display.
+// The UI code prints into RAM (same Print interface as LiquidCrystal_I2C),
+// flush() compares the buffer with what is already on the glass and sends
+// only the changed cells. Each run of changed cells is sent as one cursor
+// command plus its characters, packed into as few I2C transmissions as the
+// Wire buffer allows, instead of 3 I2C transmissions per 4-bit nibble.
+
+#define LCD_FB_COLS  16
+#define LCD_FB_ROWS  2
+
+// PCF8574 to HD44780 wiring of the common I2C backpacks (same as LiquidCrystal_I2C)
+#define LCD_FB_RS         0x01
+#define LCD_FB_EN         0x04
+#define LCD_FB_BACKLIGHT  0x08
+
+#define LCD_FB_SET_DDRAM  0x80         // set cursor command
+#define LCD_FB_BURST      28           // bytes per Wire transmission (32 byte buffer), 4 bytes per LCD byte
+#define LCD_FB_GAP        1            // unchanged cells rewritten to join two runs (cheaper than a new cursor command)
+#define LCD_FB_UNKNOWN    0xFE         // glass content not known, cell is always sent
+
+
+class lcd_framebuffer : public Print
+{
+	public:
+		lcd_framebuffer( byte i2c_addr );
+
+		void init();                              // to be called after the display was cleared by lcd.init()/lcd.clear()
+		void clear();                             // fill the buffer with spaces
+		void setCursor( byte col, byte row );
+
+		virtual size_t write( uint8_t ch );       // write at the cursor and advance it
+
+		void flush();                             // send the changed cells to the display
+
+	private:
+		void begin_burst();
+		void end_burst();
+		void send( byte value, byte mode );
+
+	protected:
+		const byte i2c_addr;
+
+		byte shadow[LCD_FB_ROWS][LCD_FB_COLS];    // what the UI wants on the display
+		byte glass[LCD_FB_ROWS][LCD_FB_COLS];     // what is on the display now
+
+		byte cursor_col;
+		byte cursor_row;
+		byte burst_len;                           // bytes in the current Wire transmission
+};
+
+
+lcd_framebuffer::lcd_framebuffer( byte addr )
+			   : i2c_addr(addr)
+{
+
+}
+
+
+void lcd_framebuffer::init()
+{
+	clear();
+	memset(glass, ' ', sizeof(glass));
+	burst_len = 0;
+}
+
+
+void lcd_framebuffer::clear()
+{
+	memset(shadow, ' ', sizeof(shadow));
+	cursor_col = 0;
+	cursor_row = 0;
+}
+
+
+void lcd_framebuffer::setCursor( byte col, byte row )
+{
+	cursor_col = col;
+	cursor_row = row;
+}
+
+
+size_t lcd_framebuffer::write( uint8_t ch )
+{
+	if ( cursor_col >= LCD_FB_COLS || cursor_row >= LCD_FB_ROWS ) {
+		return 0;
+	}
+	shadow[cursor_row][cursor_col] = ch;
+	++cursor_col;
+	return 1;
+}
+
+
+void lcd_framebuffer::flush()
+{
+	for ( byte row = 0; row < LCD_FB_ROWS; ++row ) {
+		byte col = 0;
+
+		while ( col < LCD_FB_COLS ) {
+			if ( shadow[row][col] == glass[row][col] ) {
+				++col;
+				continue;
+			}
+
+			// find the end of the run, joining runs separated by short unchanged gaps
+			byte end = col + 1;
+			byte same = 0;
+			for ( byte i = end; i < LCD_FB_COLS && same <= LCD_FB_GAP; ++i ) {
+				if ( shadow[row][i] == glass[row][i] ) {
+					++same;
+				} else {
+					same = 0;
+					end = i + 1;
+				}
+			}
+
+			send(LCD_FB_SET_DDRAM | (row * 0x40 + col), 0);
+			for ( ; col < end; ++col ) {
+				send(shadow[row][col], LCD_FB_RS);
+				glass[row][col] = shadow[row][col];
+			}
+		}
+	}
+
+	end_burst();
+}
+
+
+void lcd_framebuffer::begin_burst()
+{
+	Wire.beginTransmission(i2c_addr);
+	burst_len = 0;
+}
+
+
+void lcd_framebuffer::end_burst()
+{
+	if ( burst_len ) {
+		Wire.endTransmission();
+		burst_len = 0;
+	}
+}
+
+
+void lcd_framebuffer::send( byte value, byte mode )
+{
+	if ( burst_len + 4 > LCD_FB_BURST ) {
+		end_burst();
+	}
+	if ( burst_len == 0 ) {
+		begin_burst();
+	}
+
+	// 4-bit mode, high nibble first, data latched on the falling edge of EN.
+	// One I2C byte takes ~90 us at 100 kHz, longer than the 37 us HD44780 execution time.
+	byte high = (value & 0xF0) | mode | LCD_FB_BACKLIGHT;
+	byte low = ((value << 4) & 0xF0) | mode | LCD_FB_BACKLIGHT;
+
+	Wire.write(high | LCD_FB_EN);
+	Wire.write(high);
+	Wire.write(low | LCD_FB_EN);
+	Wire.write(low);
+	burst_len += 4;
+}
+
+
+#endif // LCD_BUFFER_HPP
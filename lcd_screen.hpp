@@ -0,0 +1,123 @@
+#ifndef LCD_SCREEN_HPP
+#define LCD_SCREEN_HPP
+
+#include "hal.hpp"
+
+// Declarative screens for the 1602 display.
+// A screen is a table of fields in flash: position, type, width and the slot
+// of its value in an int32_t array the UI fills each frame. screen_render()
+// starts from a blank framebuffer and draws every field whose value is not
+// SCREEN_HIDE, so nothing needs clearing by hand and lcd_framebuffer::flush()
+// still sends only the cells that changed. Numbers are formatted with integer
+// math only, no float printing code is linked in.
+
+#define SCREEN_TEXT_MAX  5                       // characters of a text field
+
+// field types
+#define SCREEN_TEXT      0   // text of the field, the value only hides it
+#define SCREEN_INT       1   // integer right-aligned in width cells
+#define SCREEN_FIXED     2   // fixed-point, the value in units of 10^-arg, right-aligned in width cells
+#define SCREEN_GLYPH     3   // character arg + value, for the custom glyphs and their blink phases
+#define SCREEN_FAULT     4   // MAX31865 fault register D7...D2 as "7|6|.|4|.|2"
+
+#define SCREEN_ALWAYS    0xFF                    // slot of a field that is always shown
+#define SCREEN_HIDE      (-2147483647L - 1)      // value of a field left blank
+
+
+struct screen_field
+{
+	byte col;
+	byte row;
+	byte type;
+	byte width;
+	byte slot;                        // index into the values, SCREEN_ALWAYS
+	byte arg;                         // decimals of SCREEN_FIXED, first glyph of SCREEN_GLYPH
+	char text[SCREEN_TEXT_MAX + 1];   // SCREEN_TEXT
+};
+
+
+// Writes value backwards from end with decimals digits after the point, returns the length
+inline byte screen_format( char *end, int32_t value, byte decimals )
+{
+	uint32_t magnitude = value < 0 ? 0 - (uint32_t)value : (uint32_t)value;
+	char *p = end;
+	byte digit = 0;
+	do {
+		if ( decimals && digit == decimals ) {
+			*--p = '.';
+		}
+		// 16-bit division once the number fits, much cheaper on the AVR
+		uint32_t rest = magnitude > 0xFFFF ? magnitude / 10 : (uint16_t)magnitude / 10u;
+		*--p = '0' + (byte)(magnitude - rest * 10);
+		magnitude = rest;
+		++digit;
+	} while ( magnitude || digit <= decimals );
+	if ( value < 0 ) {
+		*--p = '-';
+	}
+	return end - p;
+}
+
+
+// DISPLAY: lcd_framebuffer or anything with clear(), setCursor() and write()
+template <class DISPLAY>
+void screen_render( DISPLAY &lcd, const screen_field *layout, byte count, const int32_t *values )
+{
+	lcd.clear();
+
+	for ( byte i = 0; i < count; ++i ) {
+		const screen_field *field = layout + i;
+		byte slot = pgm_read_byte(&field->slot);
+		int32_t value = slot == SCREEN_ALWAYS ? 0 : values[slot];
+		if ( value == SCREEN_HIDE ) {
+			continue;
+		}
+		byte type = pgm_read_byte(&field->type);
+		byte width = pgm_read_byte(&field->width);
+		byte arg = pgm_read_byte(&field->arg);
+		lcd.setCursor( pgm_read_byte(&field->col), pgm_read_byte(&field->row) );
+
+		switch ( type ) {
+			case SCREEN_TEXT:
+				for ( byte c = 0; c < SCREEN_TEXT_MAX; ++c ) {
+					char ch = pgm_read_byte(&field->text[c]);
+					if ( !ch ) {
+						break;
+					}
+					lcd.write(ch);
+				}
+				break;
+
+			case SCREEN_INT:
+			case SCREEN_FIXED: {
+				char digits[12];
+				byte length = screen_format( digits + sizeof(digits), value, type == SCREEN_FIXED ? arg : 0 );
+				// right-aligned, a number too wide for the field shows as stars
+				for ( byte c = 0; c < width; ++c ) {
+					if ( length > width ) {
+						lcd.write('*');
+					} else {
+						lcd.write(c < width - length ? ' ' : digits[sizeof(digits) - width + c]);
+					}
+				}
+				break;
+			}
+
+			case SCREEN_GLYPH:
+				lcd.write( (byte)(arg + value) );
+				break;
+
+			case SCREEN_FAULT:
+				for ( byte bit = 7; bit >= 2; --bit ) {
+					lcd.write( value & (1 << bit) ? '0' + bit : '.' );
+					if ( bit != 2 ) {
+						lcd.write('|');
+					}
+				}
+				break;
+		}
+	}
+}
+
+
+#endif // LCD_SCREEN_HPP
@@ -0,0 +1,402 @@
+#ifndef MAX31865_HPP
+#define MAX31865_HPP
+
+#include "hal.hpp"
+#include "gpio.hpp"
+
+#if defined(ARDUINO)
+	#include <SPI.h>
+#endif
+
+// Non-blocking MAX31865 RTD-to-digital converter driver (SPI mode 1).
+// poll() never waits for the converter: it starts a conversion, returns, and
+// reads the result on a later call once the conversion time has passed.
+// One RTD reading carries the fault flag, so temperature and fault detection
+// are served from the same sample.
+//
+// max31865_bus     software SPI on any three gpio_pin<> types (SDI, SDO, CLK), shared by all converters
+// max31865_hw_bus  the SPI peripheral (D11 MOSI, D12 MISO, D13 SCK), Arduino only
+// max31865_bank    N converters on one bus with separate chip selects, read round-robin
+//
+// Both buses offer the same calls. The software bus clocks a byte in about
+// 6 us, every edge a single port instruction, and reads the fault register
+// only when the RTD code flags a fault; the hardware bus runs at 4 MHz and
+// reads the RTD code and the fault status in a single 8-byte burst of about
+// 20 us.
+
+// Registers
+#define MAX31865_CONFIG_REG     0x00
+#define MAX31865_RTD_MSB_REG    0x01
+#define MAX31865_HFAULT_MSB_REG 0x03
+#define MAX31865_FAULT_REG      0x07
+#define MAX31865_BURST_SIZE     7      // registers 0x01...0x07: RTD, fault thresholds, fault status
+#define MAX31865_WRITE          0x80
+
+// Configuration register bits
+#define MAX31865_CONFIG_BIAS       0x80
+#define MAX31865_CONFIG_AUTO       0x40
+#define MAX31865_CONFIG_1SHOT      0x20
+#define MAX31865_CONFIG_3WIRE      0x10
+#define MAX31865_CONFIG_FAULTSTAT  0x02
+
+// Timing
+#define MAX31865_BIAS_SETTLE_MS  10   // bias voltage settling before the first conversion
+#define MAX31865_1SHOT_MS        65   // time of a single conversion, the first one after begin()
+#define MAX31865_AUTO_MS         20   // continuous conversion period (16.7 ms with 60 Hz filter)
+
+#define MAX31865_SPI_CLOCK  4000000   // hardware bus clock, 5 MHz at most
+
+enum max31865_numwires {
+	MAX31865_2WIRE = 0,
+	MAX31865_3WIRE = 1,
+	MAX31865_4WIRE = 0
+};
+
+
+// SDI: MAX31865 data input (MOSI), SDO: its data output (MISO), CLK: gpio_pin<> types
+template <class SDI, class SDO, class CLK>
+class max31865_bus
+{
+	public:
+		max31865_bus();
+
+		void begin();
+
+		byte read_register( byte pin_cs, byte addr );
+		void write_register( byte pin_cs, byte addr, byte value );
+		uint16_t read_rtd( byte pin_cs );                 // RTD MSB and LSB in one burst, fault flag in bit 0
+		void set_thresholds( byte pin_cs, uint16_t high, uint16_t low );
+
+		// One sample: raw 15-bit RTD code and the fault status register, 0 if no fault
+		void read_sample( byte pin_cs, uint16_t &rtd, byte &fault );
+
+	private:
+		static byte transfer( byte out );
+};
+
+
+#define MAX31865_NONE  0xFF    // poll() of a bank: no channel read
+
+
+#if defined(ARDUINO)
+class max31865_hw_bus
+{
+	public:
+		max31865_hw_bus();
+
+		void begin();
+
+		byte read_register( byte pin_cs, byte addr );
+		void write_register( byte pin_cs, byte addr, byte value );
+		uint16_t read_rtd( byte pin_cs );
+		void set_thresholds( byte pin_cs, uint16_t high, uint16_t low );
+		void read_sample( byte pin_cs, uint16_t &rtd, byte &fault );
+
+	private:
+		static void select( byte pin_cs );
+		static void release( byte pin_cs );
+};
+#endif
+
+
+// N converters in continuous mode, each with its own chip select on a shared bus.
+// Every poll() reads the next channel, so called every MAX31865_AUTO_MS / N ms
+// each channel is sampled once per conversion period. Per channel state is kept
+// in one array per field.
+template <byte N, class BUS>
+class max31865_bank
+{
+	public:
+		max31865_bank( BUS &bus, const byte *pin_cs );   // pin_cs: N chip select pins in PROGMEM
+
+		void begin( max31865_numwires wires );
+
+		// Handler, reads one channel, returns its number or MAX31865_NONE before the first conversion is done
+		byte poll();
+
+		uint16_t get_rtd( byte channel ) const;       // raw 15-bit RTD code of the last sample
+		byte get_fault( byte channel ) const;         // fault status register of the last sample, 0 if no fault
+
+	protected:
+		BUS &bus;
+		const byte *pin_cs;
+
+		byte config;
+		byte next;                 // channel of the next poll()
+		bool started;
+		unsigned long int start_time;
+
+		uint16_t rtd[N];
+		byte fault[N];
+};
+
+
+/////////////////////////////////////////////////////////////// max31865_bank
+
+template <byte N, class BUS>
+max31865_bank<N, BUS>::max31865_bank( BUS &b, const byte *cs )
+				 : bus(b), pin_cs(cs)
+{
+
+}
+
+
+template <byte N, class BUS>
+void max31865_bank<N, BUS>::begin( max31865_numwires wires )
+{
+	bus.begin();
+
+	config = MAX31865_CONFIG_BIAS | MAX31865_CONFIG_AUTO;
+	if ( wires == MAX31865_3WIRE ) {
+		config |= MAX31865_CONFIG_3WIRE;
+	}
+
+	for ( byte i = 0; i < N; ++i ) {
+		byte cs = pgm_read_byte(pin_cs + i);
+		hal::pin_mode(cs, OUTPUT);
+		hal::digital_write(cs, HIGH);
+	}
+	for ( byte i = 0; i < N; ++i ) {
+		byte cs = pgm_read_byte(pin_cs + i);
+		bus.set_thresholds(cs, 0xFFFF, 0x0000);
+		bus.write_register(cs, MAX31865_CONFIG_REG, config | MAX31865_CONFIG_FAULTSTAT);
+		rtd[i] = 0;
+		fault[i] = 0;
+	}
+
+	// all converters run free, the first results are ready after the bias settling and one conversion
+	next = 0;
+	start_time = hal::millis();
+	started = false;
+}
+
+
+template <byte N, class BUS>
+byte max31865_bank<N, BUS>::poll()
+{
+	if ( !started ) {
+		if ( hal::millis() - start_time < MAX31865_BIAS_SETTLE_MS + MAX31865_1SHOT_MS ) {
+			return MAX31865_NONE;
+		}
+		started = true;
+	}
+
+	byte channel = next;
+	if ( ++next == N ) {
+		next = 0;
+	}
+
+	byte cs = pgm_read_byte(pin_cs + channel);
+	bus.read_sample(cs, rtd[channel], fault[channel]);
+	if ( fault[channel] ) {
+		bus.write_register(cs, MAX31865_CONFIG_REG, config | MAX31865_CONFIG_FAULTSTAT);
+	}
+
+	return channel;
+}
+
+
+template <byte N, class BUS>
+uint16_t max31865_bank<N, BUS>::get_rtd( byte channel ) const
+{
+	return rtd[channel];
+}
+
+
+template <byte N, class BUS>
+byte max31865_bank<N, BUS>::get_fault( byte channel ) const
+{
+	return fault[channel];
+}
+
+
+/////////////////////////////////////////////////////////////// max31865_bus
+
+template <class SDI, class SDO, class CLK>
+max31865_bus<SDI, SDO, CLK>::max31865_bus()
+{
+
+}
+
+
+template <class SDI, class SDO, class CLK>
+void max31865_bus<SDI, SDO, CLK>::begin()
+{
+	SDI::set_output();
+	CLK::set_output();
+	SDO::set_input();
+	CLK::low();
+}
+
+
+template <class SDI, class SDO, class CLK>
+byte max31865_bus<SDI, SDO, CLK>::read_register( byte pin_cs, byte addr )
+{
+	hal::digital_write(pin_cs, LOW);
+	transfer(addr);
+	byte value = transfer(0xFF);
+	hal::digital_write(pin_cs, HIGH);
+	return value;
+}
+
+
+template <class SDI, class SDO, class CLK>
+void max31865_bus<SDI, SDO, CLK>::write_register( byte pin_cs, byte addr, byte value )
+{
+	hal::digital_write(pin_cs, LOW);
+	transfer(addr | MAX31865_WRITE);
+	transfer(value);
+	hal::digital_write(pin_cs, HIGH);
+}
+
+
+template <class SDI, class SDO, class CLK>
+uint16_t max31865_bus<SDI, SDO, CLK>::read_rtd( byte pin_cs )
+{
+	// address auto-increments
+	hal::digital_write(pin_cs, LOW);
+	transfer(MAX31865_RTD_MSB_REG);
+	uint16_t code = (uint16_t)transfer(0xFF) << 8;
+	code |= transfer(0xFF);
+	hal::digital_write(pin_cs, HIGH);
+	return code;
+}
+
+
+template <class SDI, class SDO, class CLK>
+void max31865_bus<SDI, SDO, CLK>::set_thresholds( byte pin_cs, uint16_t high, uint16_t low )
+{
+	hal::digital_write(pin_cs, LOW);
+	transfer(MAX31865_HFAULT_MSB_REG | MAX31865_WRITE);
+	transfer(high >> 8);
+	transfer(high);
+	transfer(low >> 8);
+	transfer(low);
+	hal::digital_write(pin_cs, HIGH);
+}
+
+
+template <class SDI, class SDO, class CLK>
+void max31865_bus<SDI, SDO, CLK>::read_sample( byte pin_cs, uint16_t &rtd, byte &fault )
+{
+	uint16_t code = read_rtd(pin_cs);
+
+	rtd = code >> 1;
+	fault = 0;
+
+	// bit 0 of the LSB is set when any fault status bit is set, only then the fault register is read
+	if ( code & 1 ) {
+		fault = read_register(pin_cs, MAX31865_FAULT_REG);
+	}
+}
+
+
+template <class SDI, class SDO, class CLK>
+byte max31865_bus<SDI, SDO, CLK>::transfer( byte out )
+{
+	byte in = 0;
+
+	// SPI mode 1: data changes on the rising edge, sampled on the falling edge
+	for ( byte mask = 0x80; mask; mask >>= 1 ) {
+		CLK::high();
+		SDI::write(out & mask);
+		if ( SDO::read() ) {
+			in |= mask;
+		}
+		CLK::low();
+	}
+
+	return in;
+}
+
+
+/////////////////////////////////////////////////////////////// max31865_hw_bus
+
+#if defined(ARDUINO)
+max31865_hw_bus::max31865_hw_bus()
+{
+
+}
+
+
+void max31865_hw_bus::begin()
+{
+	SPI.begin();   // D10 becomes an output, the peripheral stays master
+}
+
+
+byte max31865_hw_bus::read_register( byte pin_cs, byte addr )
+{
+	select(pin_cs);
+	SPI.transfer(addr);
+	byte value = SPI.transfer(0xFF);
+	release(pin_cs);
+	return value;
+}
+
+
+void max31865_hw_bus::write_register( byte pin_cs, byte addr, byte value )
+{
+	select(pin_cs);
+	SPI.transfer(addr | MAX31865_WRITE);
+	SPI.transfer(value);
+	release(pin_cs);
+}
+
+
+uint16_t max31865_hw_bus::read_rtd( byte pin_cs )
+{
+	select(pin_cs);
+	SPI.transfer(MAX31865_RTD_MSB_REG);
+	uint16_t code = (uint16_t)SPI.transfer(0xFF) << 8;
+	code |= SPI.transfer(0xFF);
+	release(pin_cs);
+	return code;
+}
+
+
+void max31865_hw_bus::set_thresholds( byte pin_cs, uint16_t high, uint16_t low )
+{
+	select(pin_cs);
+	SPI.transfer(MAX31865_HFAULT_MSB_REG | MAX31865_WRITE);
+	SPI.transfer(high >> 8);
+	SPI.transfer(high);
+	SPI.transfer(low >> 8);
+	SPI.transfer(low);
+	release(pin_cs);
+}
+
+
+void max31865_hw_bus::read_sample( byte pin_cs, uint16_t &rtd, byte &fault )
+{
+	// RTD MSB through the fault status in one transaction, the address auto-increments
+	byte data[MAX31865_BURST_SIZE];
+	select(pin_cs);
+	SPI.transfer(MAX31865_RTD_MSB_REG);
+	for ( byte i = 0; i < MAX31865_BURST_SIZE; ++i ) {
+		data[i] = SPI.transfer(0xFF);
+	}
+	release(pin_cs);
+
+	uint16_t code = (uint16_t)data[0] << 8 | data[1];
+	rtd = code >> 1;
+	fault = (code & 1) ? data[MAX31865_FAULT_REG - MAX31865_RTD_MSB_REG] : 0;
+}
+
+
+void max31865_hw_bus::select( byte pin_cs )
+{
+	SPI.beginTransaction(SPISettings(MAX31865_SPI_CLOCK, MSBFIRST, SPI_MODE1));
+	hal::digital_write(pin_cs, LOW);
+}
+
+
+void max31865_hw_bus::release( byte pin_cs )
+{
+	hal::digital_write(pin_cs, HIGH);
+	SPI.endTransaction();
+}
+#endif
+
+
+#endif // MAX31865_HPP
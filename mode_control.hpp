@@ -1,8 +1,11 @@
 #ifndef MODE_CONTROL_HPP
 #define MODE_CONTROL_HPP
 
-#include <EEPROM.h>
-#include "buzzer.hpp"          // buzzer control
+#include "hal.hpp"
+#include "button_bank.hpp"     // button events
+#include "pid_control.hpp"     // default PID gains
+#include "param_journal.hpp"   // persisted parameters
+#include "recipe.hpp"          // operation program
 
 #define DEF_TEMP_BARIER  180   // default temperature start parameter
 #define DEF_TIME_BARIER  120   // default timer start parameter
@@ -12,30 +15,25 @@
 #define DEF_TIME_LR  10        // default possible low timer start parameter
 #define DEF_TIME_HR  240       // default possible hight timer start parameter
 
-#define DEF_TEMP_EE_ADDR  0    // default temperature start parameter EEPROM address
-#define DEF_TIME_EE_ADDR  4    // default timer start parameter EEPROM address
-
-namespace EV {
-	enum { 
-	  NONE        = 0,   // or binary 0b000
-	  SHORTPRESS  = 1,   // or binary 0b001
-	  LONGPRESS   = 2,   // or binary 0b010
-	  SECRETPRESS = 4    // or binary 0b100
-	};
-}
-
-
-// Instanciated button objects from Hot_Air_Sterilizer.ino file
-extern button_handler button_plus;
-extern button_handler button_minus;
-extern button_handler button_select;
-extern button_handler button_start;
-
-// Instanciated buzzer object from Hot_Air_Sterilizer.ino file
-extern buzzer_control buzzer;
-
-
-
+// Fixed EEPROM addresses of the firmware before the parameter journal, read once to migrate
+#define LEGACY_TEMP_EE_ADDR  0    // temperature start parameter
+#define LEGACY_TIME_EE_ADDR  4    // timer start parameter
+#define LEGACY_KP_EE_ADDR    8    // PID proportional gain (int32_t, Q16)
+#define LEGACY_KI_EE_ADDR    12   // PID integral gain (int32_t, Q16)
+#define LEGACY_KD_EE_ADDR    16   // PID derivative gain (int32_t, Q16)
+
+// Requests from outside the buttons (serial commands), each the transition of a button event
+#define MODE_REQUEST_START  0   // START shortpress in the DEFAULT mode
+#define MODE_REQUEST_ABORT  1   // START secretpress in the OPERATION and AUTOTUNE modes
+#define MODE_REQUEST_ACK    2   // PLUS and MINUS longpress in the ERROR mode
+
+// Parameters of get_parameter()/set_parameter()
+#define MODE_PARAM_TEMP   0     // temperature barier, C
+#define MODE_PARAM_TIME   1     // time barier, minutes
+#define MODE_PARAM_KP     2     // PID gains, Q16
+#define MODE_PARAM_KI     3
+#define MODE_PARAM_KD     4
+#define MODE_PARAM_COUNT  5
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Class definition
@@ -44,35 +42,55 @@ class mode_control
 {
 	public:
 		// Constructor (to be called in global)
-		mode_control( byte temp_low_range = DEF_TEMP_LR, byte temp_high_range = DEF_TEMP_HR, byte temp_barier_ee_addr = DEF_TEMP_EE_ADDR,
-					  byte time_low_range = DEF_TIME_LR, byte time_high_range = DEF_TIME_HR, byte time_barier_ee_addr = DEF_TIME_EE_ADDR );
+		mode_control( byte temp_low_range = DEF_TEMP_LR, byte temp_high_range = DEF_TEMP_HR,
+					  byte time_low_range = DEF_TIME_LR, byte time_high_range = DEF_TIME_HR );
 	
 		void init();                           // Initialization with default start parameters, to be called in the setup()
+		void eeprom_service();                 // background EEPROM writes, one byte per call, to be called in the loop()
 		
-		// Handler, to be called in the loop()
-		void control( button_handler &button_plus, button_handler &button_minus,
-				   button_handler &button_select, button_handler &button_start );
+		// Handler, to be called in the loop(), takes button_bank<> and buzzer_control<> objects
+		template <class BUTTONS, class BUZZER>
+		void control( BUTTONS &buttons, BUZZER &buzzer );
 		
 		void set_temp_barier(byte);            // set heating relay cut-off temperature barier    
 		void set_time_barier(byte);            // set ventilating relay cut-off time barier
 		
 		void set_current_mode(byte);           // set the current mode
+		bool request(byte);                    // MODE_REQUEST_*, false if the current mode does not take it
+		bool take_fault_ack();                 // the ERROR mode was acknowledged since the last call
+		
+		void set_pid_gains(int32_t kp, int32_t ki, int32_t kd);   // set PID gains and queue them for EEPROM
+		bool set_recipe(const recipe &program);                    // store a recipe (count 0 clears it), false if out of range
+		bool set_recipe_segment(byte index, const recipe_segment &segment);   // replace one, or append it after the last
+		bool set_parameter(byte param, int32_t value);             // MODE_PARAM_*, saved, false if out of range
 		
 		byte get_temp_barier() const;          // get heating relay cut-off temperature barier 
 		byte get_time_barier() const;          // get ventilating relay cut-off time barier
 		
 		byte get_current_mode() const;         // get current mode state
 		byte get_last_mode() const;            // get last mode state
+		
+		int32_t get_pid_kp() const;            // get PID proportional gain
+		int32_t get_pid_ki() const;            // get PID integral gain
+		int32_t get_pid_kd() const;            // get PID derivative gain
+		int32_t get_parameter(byte) const;     // MODE_PARAM_*
+		
+		// the stored recipe, or one segment made of the temperature and time barriers if there is none
+		void get_recipe(recipe &program) const;
+		bool has_recipe() const;               // a stored recipe takes the place of the barriers
 	
 		bool is_temp_barier_setting() const;   // for showing in display
 		bool is_time_barier_setting() const;   // for showing in display
 	
 	private:  
-		void set_temp_barier_EEPROM();         // set temperature barier to EEPROM
-		void set_time_barier_EEPROM();         // set time barier to EEPROM
+		void save_parameters_EEPROM();         // queue the barriers and gains for the journal
+		void load_legacy_EEPROM(param_record &record) const;             // parameters at the fixed addresses of older firmware
+		int32_t get_legacy_gain_EEPROM(byte addr, int32_t default_gain) const;
 		
-		byte get_temp_barier_EEPROM() const;   // get temperature barier from EEPROM
-		byte get_time_barier_EEPROM() const;   // get time barier from EEPROM
+		bool is_temp_barier_valid(byte) const;
+		bool is_time_barier_valid(byte) const;
+		static bool is_gain_valid(int32_t);
+		bool is_recipe_valid(const recipe &) const;
 				
 	protected:
 		byte current_mode;               // the current mode
@@ -80,11 +98,18 @@ class mode_control
 		byte temp_barier;                // temperature start parameter
 		byte time_barier;                // timer start parameter
 		
+		int32_t pid_kp;                  // PID proportional gain
+		int32_t pid_ki;                  // PID integral gain
+		int32_t pid_kd;                  // PID derivative gain
+		
+		recipe stored_recipe;            // count 0 if none
+		
 		bool temp_barier_set_state;      // true if temp_barier is setting now
 		bool time_barier_set_state;      // true if time_barier is setting now
+		bool autotune_armed;             // buttons released since the last error reset
+		bool fault_ack;                  // left the ERROR mode, until take_fault_ack()
 		
-		const byte temp_barier_ee_addr;  // temperature start parameter EEPROM address
-		const byte time_barier_ee_addr;  // timer start parameter EEPROM address
+		param_journal journal;           // persisted parameters
 		
 		const byte temp_low_range;       // possible low temperature start parameter
 		const byte temp_high_range;      // possible hight temperature start parameter
@@ -96,9 +121,9 @@ class mode_control
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
-mode_control::mode_control( byte temp_lr, byte temp_hr, byte temp_ee_addr, byte time_lr, byte time_hr, byte time_ee_addr)
-	: temp_low_range(temp_lr), temp_high_range(temp_hr), temp_barier_ee_addr(temp_ee_addr),
-	time_low_range(time_lr), time_high_range(time_hr), time_barier_ee_addr(time_ee_addr)
+mode_control::mode_control( byte temp_lr, byte temp_hr, byte time_lr, byte time_hr )
+	: temp_low_range(temp_lr), temp_high_range(temp_hr),
+	time_low_range(time_lr), time_high_range(time_hr)
 {
 	
 }
@@ -109,52 +134,71 @@ void mode_control::init()
 	last_mode = 0;
 	current_mode = 0;	
 	
-	byte temp_barier_eeprom = this->get_temp_barier_EEPROM();
-	if ( (temp_low_range <= temp_barier_eeprom) && (temp_high_range >= temp_barier_eeprom) ) {
-		temp_barier = temp_barier_eeprom;
-	} else {
-		temp_barier = DEF_TEMP_BARIER;
+	// one scan of the journal, an EEPROM without one is migrated from the old fixed addresses
+	param_record record;
+	if ( !journal.load(record) ) {
+		this->load_legacy_EEPROM(record);
+		journal.save(record);
 	}
 
-	byte time_barier_eeprom = this->get_time_barier_EEPROM();
-	if ( (time_low_range <= time_barier_eeprom) && (time_high_range >= time_barier_eeprom) ) {
-		time_barier = time_barier_eeprom;
-	} else {
-		time_barier = DEF_TIME_BARIER;
+	temp_barier = this->is_temp_barier_valid(record.temp_barier) ? record.temp_barier : DEF_TEMP_BARIER;
+	time_barier = this->is_time_barier_valid(record.time_barier) ? record.time_barier : DEF_TIME_BARIER;
+
+	pid_kp = is_gain_valid(record.pid_kp) ? record.pid_kp : DEF_PID_KP;
+	pid_ki = is_gain_valid(record.pid_ki) ? record.pid_ki : DEF_PID_KI;
+	pid_kd = is_gain_valid(record.pid_kd) ? record.pid_kd : DEF_PID_KD;
+	
+	stored_recipe = record.program;
+	if ( !this->is_recipe_valid(stored_recipe) ) {
+		stored_recipe.count = 0;
 	}
 
 	temp_barier_set_state = 0;
-	temp_barier_set_state = 0;
+	time_barier_set_state = 0;
+	autotune_armed = false;
+	fault_ack = false;
 }
 
 
-void mode_control::control( button_handler &button_plus, button_handler &button_minus,
-						 button_handler &button_select, button_handler &button_start )
+template <class BUTTONS, class BUZZER>
+void mode_control::control( BUTTONS &buttons, BUZZER &buzzer )
 {
-	byte event_button_plus = button_plus.handle();
-	byte event_button_minus = button_minus.handle();
-	byte event_button_select = button_select.handle();
-	byte event_button_start = button_start.handle();
+	buttons.handle();
 	
-	byte last_event_button_plus = button_plus.get_last_event();
-	byte last_event_button_minus = button_minus.get_last_event();
-//	byte last_event_button_select = button_select.get_last_event();
-//	byte last_event_button_start = button_start.get_last_event();
+	// bitmasks of BUTTON::PLUS/MINUS/SELECT/START
+	byte shortpress = buttons.get_shortpress();
+	byte longpress = buttons.get_longpress();
+	byte secretpress = buttons.get_secretpress();
+	
+	// held in long or secret press
+	byte held_long = buttons.get_last_longpress();
+	byte held_secret = buttons.get_last_secretpress();
+	// the parameter steps once at the long press, then at the autorepeat rate of button_bank
+	byte repeat = longpress | buttons.get_repeat();
 
-	buzzer.buttons( event_button_plus, event_button_minus, event_button_select, event_button_start );
+	buzzer.buttons( shortpress, longpress, secretpress & BUTTON::START );
+	
+	// the AUTOTUNE combo counts only for a fresh press, not one still held from an error reset
+	if ( !buttons.get_state() ) {
+		autotune_armed = true;
+	}
 	
 	switch(current_mode) {
 		// DEFAULT mode (ready for start, plus and minus not available)
 		case 0:
 		{
-			if ( EV::SHORTPRESS == event_button_start ) {          // shortpress
-				last_mode = current_mode;                          // save the last mode
-				current_mode = 2;                                  // next -> start and control relays
+			if ( BUTTON::START & shortpress ) {                    // shortpress
+				this->request(MODE_REQUEST_START);                 // next -> start and control relays
 				break;
-			} else if ( EV::SHORTPRESS == event_button_select ) {  // shortpress
+			} else if ( BUTTON::SELECT & shortpress ) {            // shortpress
 				last_mode = current_mode;                          // save the last mode
 				current_mode = 1;                                  // next -> go to select mode for control start parameters
 				break;
+			} else if ( autotune_armed && (BUTTON::PLUS | BUTTON::MINUS) == (held_secret & (BUTTON::PLUS | BUTTON::MINUS)) ) {   // plus and minus secretpress
+				autotune_armed = false;
+				last_mode = current_mode;                          // save the last mode
+				current_mode = 4;                                  // next -> relay feedback autotune around the temperature barier
+				break;
 			}
 			
 			last_mode = current_mode;
@@ -167,7 +211,7 @@ void mode_control::control( button_handler &button_plus, button_handler &button_
 		{
 			static bool select_parameter = 1;   // temperature selected by default
 			
-			if ( EV::SHORTPRESS == event_button_select ) {   // shortpress
+			if ( BUTTON::SELECT & shortpress ) {             // shortpress
 				select_parameter = !select_parameter;
 			}      
 			
@@ -175,35 +219,26 @@ void mode_control::control( button_handler &button_plus, button_handler &button_
 			if ( select_parameter ) {
 				time_barier_set_state = 0;
 				temp_barier_set_state = 1;
-				if ( (EV::SHORTPRESS == event_button_plus) && (temp_high_range > temp_barier) ) {   // shortpress
-					++temp_barier;
-				} else if ( ((EV::LONGPRESS | EV::SECRETPRESS) & (event_button_plus | last_event_button_plus)) && (temp_high_range > temp_barier) ) {   // longpress and secretpress
+				if ( ((shortpress | repeat) & BUTTON::PLUS) && (temp_high_range > temp_barier) ) {     // shortpress, longpress and autorepeat
 					++temp_barier;
 				}
-				if ( (EV::SHORTPRESS == event_button_minus) && (temp_low_range < temp_barier)) {   // shortpress
-					--temp_barier;
-				} else if ( ((EV::LONGPRESS | EV::SECRETPRESS) & (event_button_minus | last_event_button_minus)) && (temp_low_range < temp_barier) ) {   // longpress and secretpress
+				if ( ((shortpress | repeat) & BUTTON::MINUS) && (temp_low_range < temp_barier) ) {     // shortpress, longpress and autorepeat
 					--temp_barier;
 				}
 			// time start parameter control
 			} else {
 				temp_barier_set_state = 0;
 				time_barier_set_state = 1;
-				if ( (EV::SHORTPRESS == event_button_plus) && (time_high_range > time_barier) ) {   // shortpress
+				if ( ((shortpress | repeat) & BUTTON::PLUS) && (time_high_range > time_barier) ) {     // shortpress, longpress and autorepeat
 					++time_barier;
-				} else if ( ((EV::LONGPRESS | EV::SECRETPRESS) & (event_button_plus | last_event_button_plus)) && (time_high_range > time_barier) ) {   // longpress and secretpress
-					++time_barier;					
 				}
-				if ( (EV::SHORTPRESS == event_button_minus) && (time_low_range < time_barier) ) {   // shortpress
-					--time_barier;
-				} else if ( ((EV::LONGPRESS | EV::SECRETPRESS) & (event_button_minus | last_event_button_minus)) && (time_low_range < time_barier) ) {   // longpress and secretpress
+				if ( ((shortpress | repeat) & BUTTON::MINUS) && (time_low_range < time_barier) ) {     // shortpress, longpress and autorepeat
 					--time_barier;
 				}
 			}
 			
-			if ( EV::LONGPRESS == event_button_select ) {   // longpress
-				this->set_temp_barier_EEPROM();
-				this->set_time_barier_EEPROM();
+			if ( BUTTON::SELECT & longpress ) {             // longpress
+				this->save_parameters_EEPROM();
 				temp_barier_set_state = 0;
 				time_barier_set_state = 0;
 				last_mode = current_mode;                   // save the last mode  
@@ -219,9 +254,8 @@ void mode_control::control( button_handler &button_plus, button_handler &button_
 		// OPERATION mode (select, plus, minus not available)
 		case 2:
 		{
-			if ( EV::SECRETPRESS == event_button_start ) {  // secretpress 3 sec
-				last_mode = current_mode;                   // save the last mode
-				current_mode = 0;                           // abort operation, DEFAULT mode, next ->	shut down relays
+			if ( BUTTON::START & secretpress ) {            // secretpress 3 sec
+				this->request(MODE_REQUEST_ABORT);          // abort operation, DEFAULT mode, next ->	shut down relays
 				break;
 			}
 			last_mode = current_mode;
@@ -232,9 +266,19 @@ void mode_control::control( button_handler &button_plus, button_handler &button_
 		case 3:
 		{
 			// To reset error mode hold plus and minus buttons same time 
-			if ( (EV::LONGPRESS & (event_button_plus | last_event_button_plus)) && (EV::LONGPRESS & (event_button_minus | last_event_button_minus)) ) {
-				last_mode = current_mode;                   // save the last mode
-				current_mode = 0;                           // reset error, next -> DEFAULT mode, ready for start
+			if ( (BUTTON::PLUS | BUTTON::MINUS) == (held_long & (BUTTON::PLUS | BUTTON::MINUS)) ) {
+				this->request(MODE_REQUEST_ACK);            // reset error, next -> DEFAULT mode, ready for start
+				break;
+			}
+			last_mode = current_mode;
+			break;
+		}
+		
+		// AUTOTUNE mode (select, plus, minus not available)
+		case 4:
+		{
+			if ( BUTTON::START & secretpress ) {            // secretpress 3 sec
+				this->request(MODE_REQUEST_ABORT);          // abort autotune, gains unchanged, DEFAULT mode
 				break;
 			}
 			last_mode = current_mode;
@@ -265,6 +309,134 @@ void mode_control::set_current_mode(byte curr_mode)
 }
 
 
+bool mode_control::request(byte remote)
+{
+	switch(remote) {
+		case MODE_REQUEST_START:
+			if ( current_mode != 0 ) {
+				return false;
+			}
+			this->set_current_mode(2);
+			return true;
+		
+		case MODE_REQUEST_ABORT:
+			if ( current_mode != 2 && current_mode != 4 ) {
+				return false;
+			}
+			this->set_current_mode(0);
+			return true;
+		
+		case MODE_REQUEST_ACK:
+			if ( current_mode != 3 ) {
+				return false;
+			}
+			this->set_current_mode(0);
+			autotune_armed = false;
+			fault_ack = true;     // the next button pass overwrites last_mode, this stays for the control task
+			return true;
+	}
+	return false;
+}
+
+
+bool mode_control::take_fault_ack()
+{
+	bool ack = fault_ack;
+	fault_ack = false;
+	return ack;
+}
+
+
+void mode_control::set_pid_gains(int32_t kp, int32_t ki, int32_t kd)
+{
+	pid_kp = kp;
+	pid_ki = ki;
+	pid_kd = kd;
+	this->save_parameters_EEPROM();
+}
+
+
+bool mode_control::set_recipe(const recipe &program)
+{
+	if ( !this->is_recipe_valid(program) ) {
+		return false;
+	}
+	stored_recipe = program;
+	this->save_parameters_EEPROM();
+	return true;
+}
+
+
+bool mode_control::set_parameter(byte param, int32_t value)
+{
+	switch(param) {
+		case MODE_PARAM_TEMP:
+			if ( value < 0 || value > 255 || !this->is_temp_barier_valid(value) ) {
+				return false;
+			}
+			temp_barier = value;
+			break;
+		
+		case MODE_PARAM_TIME:
+			if ( value < 0 || value > 255 || !this->is_time_barier_valid(value) ) {
+				return false;
+			}
+			time_barier = value;
+			break;
+		
+		case MODE_PARAM_KP:
+		case MODE_PARAM_KI:
+		case MODE_PARAM_KD:
+			if ( !is_gain_valid(value) ) {
+				return false;
+			}
+			if ( param == MODE_PARAM_KP ) {
+				pid_kp = value;
+			} else if ( param == MODE_PARAM_KI ) {
+				pid_ki = value;
+			} else {
+				pid_kd = value;
+			}
+			break;
+		
+		default:
+			return false;
+	}
+	this->save_parameters_EEPROM();
+	return true;
+}
+
+
+bool mode_control::set_recipe_segment(byte index, const recipe_segment &segment)
+{
+	if ( index > stored_recipe.count || index >= RECIPE_MAX_SEGMENTS ) {
+		return false;
+	}
+	recipe program = stored_recipe;
+	program.segments[index] = segment;
+	if ( index == program.count ) {
+		++program.count;
+	}
+	return this->set_recipe(program);
+}
+
+
+void mode_control::get_recipe(recipe &program) const
+{
+	if ( stored_recipe.count ) {
+		program = stored_recipe;
+	} else {
+		recipe_single(program, temp_barier, time_barier);
+	}
+}
+
+
+bool mode_control::has_recipe() const
+{
+	return stored_recipe.count != 0;
+}
+
+
 byte mode_control::get_temp_barier() const
 {
 	return temp_barier;
@@ -287,6 +459,33 @@ byte mode_control::get_last_mode() const
 	return last_mode;
 }
 
+int32_t mode_control::get_pid_kp() const
+{
+	return pid_kp;
+}
+
+int32_t mode_control::get_pid_ki() const
+{
+	return pid_ki;
+}
+
+int32_t mode_control::get_pid_kd() const
+{
+	return pid_kd;
+}
+
+int32_t mode_control::get_parameter(byte param) const
+{
+	switch(param) {
+		case MODE_PARAM_TEMP: return temp_barier;
+		case MODE_PARAM_TIME: return time_barier;
+		case MODE_PARAM_KP:   return pid_kp;
+		case MODE_PARAM_KI:   return pid_ki;
+		case MODE_PARAM_KD:   return pid_kd;
+	}
+	return 0;
+}
+
 bool mode_control::is_temp_barier_setting() const
 {
 	return temp_barier_set_state;
@@ -299,39 +498,89 @@ bool mode_control::is_time_barier_setting() const
 
 /////////////////////////////////////////////////////////////// EEPROM control
 
-void mode_control::set_temp_barier_EEPROM()
+void mode_control::eeprom_service()
 {
-	if ( (temp_low_range <= temp_barier) && (temp_high_range >= temp_barier) ) {
-		EEPROM.put(temp_barier_ee_addr, temp_barier);
-	}
+	journal.service();
+}
+
+
+void mode_control::save_parameters_EEPROM()
+{
+	param_record record;
+	record.temp_barier = temp_barier;
+	record.time_barier = time_barier;
+	record.pid_kp = pid_kp;
+	record.pid_ki = pid_ki;
+	record.pid_kd = pid_kd;
+	record.program = stored_recipe;
+	journal.save(record);
 }
 
 
-void mode_control::set_time_barier_EEPROM()
+void mode_control::load_legacy_EEPROM(param_record &record) const
 {
-	if ( (time_low_range <= time_barier) && (time_high_range >= time_barier) ) {
-		EEPROM.put(time_barier_ee_addr, time_barier);
+	// erased EEPROM reads as 0xFF, which is out of range, the defaults apply
+	record.temp_barier = hal::eeprom_read(LEGACY_TEMP_EE_ADDR);
+	if ( !this->is_temp_barier_valid(record.temp_barier) ) {
+		record.temp_barier = DEF_TEMP_BARIER;
+	}
+	
+	record.time_barier = hal::eeprom_read(LEGACY_TIME_EE_ADDR);
+	if ( !this->is_time_barier_valid(record.time_barier) ) {
+		record.time_barier = DEF_TIME_BARIER;
 	}
+	
+	record.pid_kp = this->get_legacy_gain_EEPROM(LEGACY_KP_EE_ADDR, DEF_PID_KP);
+	record.pid_ki = this->get_legacy_gain_EEPROM(LEGACY_KI_EE_ADDR, DEF_PID_KI);
+	record.pid_kd = this->get_legacy_gain_EEPROM(LEGACY_KD_EE_ADDR, DEF_PID_KD);
+	
+	record.program.count = 0;   // no recipes before the journal
 }
 
 
-byte mode_control::get_temp_barier_EEPROM() const
+int32_t mode_control::get_legacy_gain_EEPROM(byte addr, int32_t default_gain) const
 {
-	byte temp_barier_eeprom;
-	EEPROM.get(temp_barier_ee_addr, temp_barier_eeprom);
-	if ( (temp_low_range <= temp_barier_eeprom) && (temp_high_range >= temp_barier_eeprom) ) {
-		return temp_barier_eeprom;
+	uint32_t gain_eeprom = 0;
+	for ( byte i = 0; i < sizeof(gain_eeprom); ++i ) {
+		gain_eeprom |= (uint32_t)hal::eeprom_read(addr + i) << (8 * i);
 	}
+	// erased EEPROM reads as 0xFFFFFFFF, which is out of range
+	return is_gain_valid(gain_eeprom) ? (int32_t)gain_eeprom : default_gain;
+}
+
+
+bool mode_control::is_temp_barier_valid(byte value) const
+{
+	return (temp_low_range <= value) && (temp_high_range >= value);
 }
 
 
-byte mode_control::get_time_barier_EEPROM() const
+bool mode_control::is_time_barier_valid(byte value) const
 {
-	byte time_barier_eeprom;
-	EEPROM.get(time_barier_ee_addr, time_barier_eeprom);
-	if ( (time_low_range <= time_barier_eeprom) && (time_high_range >= time_barier_eeprom) ) {
-		return time_barier_eeprom;
+	return (time_low_range <= value) && (time_high_range >= value);
+}
+
+
+bool mode_control::is_gain_valid(int32_t gain)
+{
+	return (0 <= gain) && (PID_GAIN_MAX >= gain);
+}
+
+
+bool mode_control::is_recipe_valid(const recipe &program) const
+{
+	if ( program.count > RECIPE_MAX_SEGMENTS ) {
+		return false;
+	}
+	// a cooling segment waits for the oven to fall to its target without a timeout, the low range keeps it
+	// above what the oven reaches without a chiller
+	for ( byte i = 0; i < program.count; ++i ) {
+		const recipe_segment &segment = program.segments[i];
+		if ( !this->is_temp_barier_valid(segment.target) || segment.hold > time_high_range ) {
+			return false;
+		}
 	}
+	return true;
 }
 
 
@@ -0,0 +1,196 @@
+#ifndef PARAM_JOURNAL_HPP
+#define PARAM_JOURNAL_HPP
+
+#include "hal.hpp"
+#include "crc16.hpp"
+#include "recipe.hpp"
+
+// Wear-levelled parameter journal in EEPROM.
+// Every save appends a complete record to the next slot of a ring, so each
+// cell is written once per PARAM_SLOTS saves. The newest valid record wins at
+// startup, found in one scan by its sequence number. A record is written in the
+// background, one byte per service() call, so an EEPROM write (3.3 ms) never
+// stalls the loop; saves that arrive before it is done are coalesced into the
+// same slot. The CRC comes last, a slot cut short by a power loss is ignored and
+// the previous record stays in effect.
+//
+// Slot, little-endian:
+//   0  u8   record version (PARAM_VERSION), records of other versions are ignored
+//   1  u16  sequence number
+//   3  u8   temperature barier
+//   4  u8   time barier
+//   5  i32  PID proportional gain, Q16
+//   9  i32  PID integral gain, Q16
+//  13  i32  PID derivative gain, Q16
+//  17  u8   recipe segment count, 0: no recipe (0xFF of records written without one reads as 0)
+//  18       recipe segments, 4 bytes each (recipe.hpp)
+//  30  u16  CRC-16 of bytes 0...29
+
+#define PARAM_VERSION       1
+#define PARAM_JOURNAL_ADDR  0          // EEPROM 0...511, the rest is left for other data
+#define PARAM_SLOT_SIZE     32
+#define PARAM_SLOTS         16
+#define PARAM_JOURNAL_END   (PARAM_JOURNAL_ADDR + PARAM_SLOT_SIZE * PARAM_SLOTS)
+
+#define PARAM_PAYLOAD_ADDR  3          // first parameter byte in a slot
+#define PARAM_RECIPE_ADDR   17         // recipe in a slot
+#define PARAM_CRC_ADDR      (PARAM_SLOT_SIZE - 2)
+
+#if PARAM_RECIPE_ADDR + RECIPE_SIZE > PARAM_CRC_ADDR
+	#error "the recipe does not fit the journal record"
+#endif
+
+
+struct param_record
+{
+	byte temp_barier;
+	byte time_barier;
+	int32_t pid_kp;
+	int32_t pid_ki;
+	int32_t pid_kd;
+	recipe program;
+};
+
+
+class param_journal
+{
+	public:
+		param_journal();
+
+		bool load( param_record &record );            // newest valid record, false if there is none
+		void save( const param_record &record );      // queued, written by service()
+
+		void service();                               // writes at most one byte, to be called in the loop()
+		bool is_busy() const;                         // a record is being written
+
+	private:
+		static void put_int32( byte *data, int32_t value );
+		static int32_t get_int32( const byte *data );
+		static int slot_addr( byte slot );
+
+	protected:
+		byte image[PARAM_SLOT_SIZE];   // slot being written
+		byte write_pos;                // next byte of image, PARAM_SLOT_SIZE when idle
+		byte slot;                     // slot of the newest record
+		uint16_t sequence;             // sequence number of the newest record
+};
+
+
+param_journal::param_journal()
+			 : write_pos(PARAM_SLOT_SIZE), slot(PARAM_SLOTS - 1), sequence(0)
+{
+
+}
+
+
+bool param_journal::load( param_record &record )
+{
+	bool found = false;
+	byte data[PARAM_SLOT_SIZE];
+
+	for ( byte s = 0; s < PARAM_SLOTS; ++s ) {
+		int addr = slot_addr(s);
+		for ( byte i = 0; i < PARAM_SLOT_SIZE; ++i ) {
+			data[i] = hal::eeprom_read(addr + i);
+		}
+
+		uint16_t crc = data[PARAM_CRC_ADDR] | (uint16_t)data[PARAM_CRC_ADDR + 1] << 8;
+		if ( data[0] != PARAM_VERSION || crc != crc16(data, PARAM_CRC_ADDR) ) {
+			continue;
+		}
+
+		// sequence numbers wrap, newer means ahead by less than half the range
+		uint16_t seq = data[1] | (uint16_t)data[2] << 8;
+		if ( found && (int16_t)(seq - sequence) <= 0 ) {
+			continue;
+		}
+
+		found = true;
+		slot = s;
+		sequence = seq;
+
+		const byte *payload = data + PARAM_PAYLOAD_ADDR;
+		record.temp_barier = payload[0];
+		record.time_barier = payload[1];
+		record.pid_kp = get_int32(payload + 2);
+		record.pid_ki = get_int32(payload + 6);
+		record.pid_kd = get_int32(payload + 10);
+		recipe_decode(data + PARAM_RECIPE_ADDR, record.program);
+	}
+
+	return found;
+}
+
+
+void param_journal::save( const param_record &record )
+{
+	// a record still being written is replaced in its own slot
+	if ( !is_busy() ) {
+		slot = (slot + 1) % PARAM_SLOTS;
+		++sequence;
+	}
+
+	for ( byte i = 0; i < PARAM_SLOT_SIZE; ++i ) {
+		image[i] = 0xFF;
+	}
+	image[0] = PARAM_VERSION;
+	image[1] = sequence;
+	image[2] = sequence >> 8;
+
+	byte *payload = image + PARAM_PAYLOAD_ADDR;
+	payload[0] = record.temp_barier;
+	payload[1] = record.time_barier;
+	put_int32(payload + 2, record.pid_kp);
+	put_int32(payload + 6, record.pid_ki);
+	put_int32(payload + 10, record.pid_kd);
+	recipe_encode(record.program, image + PARAM_RECIPE_ADDR);
+
+	uint16_t crc = crc16(image, PARAM_CRC_ADDR);
+	image[PARAM_CRC_ADDR] = crc;
+	image[PARAM_CRC_ADDR + 1] = crc >> 8;
+
+	write_pos = 0;
+}
+
+
+void param_journal::service()
+{
+	if ( !is_busy() || !hal::eeprom_ready() ) {
+		return;
+	}
+	hal::eeprom_write(slot_addr(slot) + write_pos, image[write_pos]);
+	++write_pos;
+}
+
+
+bool param_journal::is_busy() const
+{
+	return write_pos < PARAM_SLOT_SIZE;
+}
+
+
+void param_journal::put_int32( byte *data, int32_t value )
+{
+	for ( byte i = 0; i < 4; ++i ) {
+		data[i] = (uint32_t)value >> (8 * i);
+	}
+}
+
+
+int32_t param_journal::get_int32( const byte *data )
+{
+	uint32_t value = 0;
+	for ( byte i = 0; i < 4; ++i ) {
+		value |= (uint32_t)data[i] << (8 * i);
+	}
+	return value;
+}
+
+
+int param_journal::slot_addr( byte slot )
+{
+	return PARAM_JOURNAL_ADDR + slot * PARAM_SLOT_SIZE;
+}
+
+
+#endif // PARAM_JOURNAL_HPP
@@ -0,0 +1,143 @@
+#ifndef PID_CONTROL_HPP
+#define PID_CONTROL_HPP
+
+#include "hal.hpp"
+
+// Q16.16 fixed point, 1.0 == 65536
+#define Q16_SHIFT  16
+#define Q16_ONE    65536L
+#define Q16(x)     ((int32_t)((x) * 65536.0 + 0.5))   // for compile-time constants only
+
+// Gains are in heater duty counts (0...255) per centi-degree, Ki and Kd per PID sample
+#define DEF_PID_KP  Q16(0.25)      // 25 counts per degree of error
+#define DEF_PID_KI  Q16(0.002)     // integral time 125 samples
+#define DEF_PID_KD  Q16(5.0)       // derivative time 20 samples
+
+#define PID_GAIN_MAX   Q16(100.0)  // upper sanity limit for stored gains
+
+#define PID_OUT_MIN  0             // heater duty range
+#define PID_OUT_MAX  255
+
+#define PID_SAMPLE_MS  1000        // PID update period
+
+
+class pid_control
+{
+	public:
+		pid_control( int32_t kp = DEF_PID_KP, int32_t ki = DEF_PID_KI, int32_t kd = DEF_PID_KD );
+
+		void reset();                                  // clear integral and derivative history
+		void set_gains( int32_t kp, int32_t ki, int32_t kd );
+		void preload( byte duty );                     // start the integral at a known holding duty
+
+		// One PID step, setpoint and measurement in centi-degrees, returns heater duty 0...255
+		byte update( int32_t setpoint, int32_t measurement );
+
+		int32_t get_kp() const;
+		int32_t get_ki() const;
+		int32_t get_kd() const;
+
+	private:
+		static int32_t clamp( int64_t value, int32_t low, int32_t high );
+
+	protected:
+		int32_t kp;                 // proportional gain, Q16
+		int32_t ki;                 // integral gain, Q16
+		int32_t kd;                 // derivative gain, Q16
+
+		int32_t integral;           // integral term in Q16 duty counts
+		int32_t last_measurement;   // previous measurement for derivative-on-measurement
+		bool first_sample;          // no derivative on the first sample after reset
+};
+
+
+pid_control::pid_control( int32_t p, int32_t i, int32_t d )
+			: kp(p), ki(i), kd(d)
+{
+	reset();
+}
+
+
+void pid_control::reset()
+{
+	integral = 0;
+	last_measurement = 0;
+	first_sample = true;
+}
+
+
+void pid_control::set_gains( int32_t p, int32_t i, int32_t d )
+{
+	kp = p;
+	ki = i;
+	kd = d;
+}
+
+
+void pid_control::preload( byte duty )
+{
+	integral = (int32_t)duty << Q16_SHIFT;
+}
+
+
+byte pid_control::update( int32_t setpoint, int32_t measurement )
+{
+	const int32_t out_min = (int32_t)PID_OUT_MIN << Q16_SHIFT;
+	const int32_t out_max = (int32_t)PID_OUT_MAX << Q16_SHIFT;
+
+	int32_t error = setpoint - measurement;
+
+	// derivative acts on the measurement, so setpoint changes don't kick the output
+	int32_t delta = first_sample ? 0 : measurement - last_measurement;
+	last_measurement = measurement;
+	first_sample = false;
+
+	int32_t p_term = clamp( (int64_t)kp * error, -out_max, out_max );
+	int32_t d_term = clamp( -(int64_t)kd * delta, -out_max, out_max );
+
+	// anti-windup: integrate only while the output is not saturated in the direction of the error,
+	// and never let the integral alone leave the output range
+	int64_t unclamped = (int64_t)p_term + integral + d_term;
+	if ( !(unclamped >= out_max && error > 0) && !(unclamped <= out_min && error < 0) ) {
+		integral = clamp( (int64_t)integral + (int64_t)ki * error, out_min, out_max );
+	}
+
+	int32_t output = clamp( (int64_t)p_term + integral + d_term, out_min, out_max );
+
+	// round to the nearest duty count
+	output = (output + (Q16_ONE >> 1)) >> Q16_SHIFT;
+	return output > PID_OUT_MAX ? PID_OUT_MAX : output;
+}
+
+
+int32_t pid_control::get_kp() const
+{
+	return kp;
+}
+
+
+int32_t pid_control::get_ki() const
+{
+	return ki;
+}
+
+
+int32_t pid_control::get_kd() const
+{
+	return kd;
+}
+
+
+int32_t pid_control::clamp( int64_t value, int32_t low, int32_t high )
+{
+	if ( value < low ) {
+		return low;
+	}
+	if ( value > high ) {
+		return high;
+	}
+	return (int32_t)value;
+}
+
+
+#endif // PID_CONTROL_HPP
@@ -0,0 +1,145 @@
+#ifndef POWER_IDLE_HPP
+#define POWER_IDLE_HPP
+
+#include "hal.hpp"
+#include "gpio.hpp"
+#include "button_bank.hpp"   // BUTTON_COUNT
+
+#if defined(ARDUINO)
+	#include <avr/sleep.h>
+	#include <avr/power.h>
+#endif
+
+// Low-power idle of the DEFAULT and SELECT modes.
+// After IDLE_AFTER_MS in these modes without a button, update() reports
+// IDLE_ENTER and the sketch slows its tasks down to IDLE_TASK_MS and
+// suspends the button polling; the heaters are off in these modes, so it
+// stops the heater timer as well (heater_timer_stop()). Between tasks sleep()
+// puts the CPU to sleep until the next interrupt: the millis() tick, the UART
+// or a pin change of the buttons. A button edge wakes it through the pin
+// change interrupt and the next update() reports IDLE_LEAVE, as does a mode
+// that does not allow idling, so the normal rates and the heater timer are
+// back within one loop pass. SLEEP_MODE_IDLE keeps Timer0 and the UART
+// running, the RAM and the relay outputs as they are.
+
+#define IDLE_AFTER_MS  30000UL    // in mode 0/1 without a button press this long
+#define IDLE_TASK_MS   1000       // period of the slowed tasks (sensor, control, display, telemetry)
+
+// update() results
+#define IDLE_NONE   0
+#define IDLE_ENTER  1
+#define IDLE_LEAVE  2
+
+
+// FIRST_PIN: pin of the first of the BUTTON_COUNT buttons (button_bank)
+template <byte FIRST_PIN>
+class power_idle
+{
+	public:
+		power_idle();
+
+		void init();                          // pin change interrupt of the buttons, the unused ADC off
+
+		// Every loop() pass; allowed: a mode that may idle and no button held
+		byte update( bool allowed );
+		bool is_idle() const;
+
+		void sleep();                         // until the next interrupt, to be called when no task is due
+
+		void pin_change();                    // from the pin change interrupt of the button port
+
+	protected:
+		volatile bool woken;                  // a button edge since the last update()
+		bool idle;
+		uint32_t active_time;                 // last button edge or mode that did not allow idling
+};
+
+
+template <byte FIRST_PIN>
+power_idle<FIRST_PIN>::power_idle()
+		  : woken(false), idle(false), active_time(0)
+{
+
+}
+
+
+template <byte FIRST_PIN>
+void power_idle<FIRST_PIN>::init()
+{
+	active_time = hal::millis();
+
+#if defined(ARDUINO)
+	// D8...D13 are PCINT0...5 (PCIE0), A0...A5 PCINT8...13 (PCIE1), D0...D7 PCINT16...23 (PCIE2)
+	const byte mask = ((1 << BUTTON_COUNT) - 1) << gpio_pin<FIRST_PIN>::bit;
+	if ( FIRST_PIN < 8 ) {
+		PCMSK2 |= mask;
+		PCICR |= _BV(PCIE2);
+	} else if ( FIRST_PIN < 14 ) {
+		PCMSK0 |= mask;
+		PCICR |= _BV(PCIE0);
+	} else {
+		PCMSK1 |= mask;
+		PCICR |= _BV(PCIE1);
+	}
+
+	// the buttons are read as digital pins, the ADC and the comparator are not used
+	ADCSRA &= ~_BV(ADEN);
+	ACSR |= _BV(ACD);
+	power_adc_disable();
+#endif
+}
+
+
+template <byte FIRST_PIN>
+byte power_idle<FIRST_PIN>::update( bool allowed )
+{
+	uint32_t now = hal::millis();
+
+	if ( woken || !allowed ) {
+		woken = false;
+		active_time = now;
+		if ( idle ) {
+			idle = false;
+			return IDLE_LEAVE;
+		}
+	} else if ( !idle && now - active_time >= IDLE_AFTER_MS ) {
+		idle = true;
+		return IDLE_ENTER;
+	}
+	return IDLE_NONE;
+}
+
+
+template <byte FIRST_PIN>
+bool power_idle<FIRST_PIN>::is_idle() const
+{
+	return idle;
+}
+
+
+template <byte FIRST_PIN>
+void power_idle<FIRST_PIN>::sleep()
+{
+#if defined(ARDUINO)
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	if ( !woken ) {
+		// sei() lets the next instruction run first, an edge in between still ends the sleep
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sei();
+#endif
+}
+
+
+template <byte FIRST_PIN>
+void power_idle<FIRST_PIN>::pin_change()
+{
+	woken = true;
+}
+
+
+#endif // POWER_IDLE_HPP
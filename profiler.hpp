@@ -0,0 +1,200 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "hal.hpp"
+
+// Loop and stage latency instrumentation.
+// Every stage keeps min/max/mean run time in microseconds over a report window,
+// the control task keeps a histogram of its period jitter. Compiled out with
+// PROFILING 0, otherwise the report is switched on and off at run time and
+// printed over Serial one line at a time, only when the TX buffer has room,
+// so reporting never blocks the loop.
+
+#ifndef PROFILING
+	#define PROFILING  1
+#endif
+
+#define PROFILE_MAX_STAGES   6
+#define PROFILE_REPORT_MS    5000   // report window
+#define PROFILE_JITTER_BINS  8      // |period error| < 1, 2, 4 ... 64 ms and >= 64 ms
+#define PROFILE_LINE_MAX     48     // longest report line, bytes
+
+
+class loop_profiler
+{
+	public:
+		// stage_names: PROGMEM table of PROGMEM strings, one per stage
+		loop_profiler( const char * const *stage_names, byte stage_count );
+
+		void reset();                                   // start a new report window
+
+		void record( byte stage, uint32_t duration_us );
+		void record_period( uint32_t start_us, uint16_t period_ms );   // call at every start of a periodic task
+
+		void set_report( bool enabled );
+		bool is_report_enabled() const;
+
+		// Handler, to be called periodically, prints at most one report line
+		void report( Print &out );
+
+	protected:
+		struct stage_stats {
+			uint32_t min;
+			uint32_t max;
+			uint32_t sum;
+			uint16_t count;
+		};
+
+		const char * const *stage_names;
+		const byte stage_count;
+
+		stage_stats stages[PROFILE_MAX_STAGES];
+		uint16_t jitter[PROFILE_JITTER_BINS];
+		uint32_t last_period_start;
+
+		bool report_enabled;
+		byte report_line;                               // next line to print, 0 when idle
+		uint32_t window_start;
+};
+
+
+// Measures the run time of the enclosing scope
+class profile_scope
+{
+	public:
+		profile_scope( loop_profiler &p, byte s ) : profiler(p), stage(s), start(hal::micros()) {}
+		~profile_scope() { profiler.record(stage, hal::micros() - start); }
+
+	protected:
+		loop_profiler &profiler;
+		const byte stage;
+		const uint32_t start;
+};
+
+
+#if PROFILING
+	#define PROFILE_STAGE(profiler, stage)  profile_scope profile_scope_##stage(profiler, stage)
+#else
+	#define PROFILE_STAGE(profiler, stage)
+#endif
+
+
+loop_profiler::loop_profiler( const char * const *names, byte count )
+			 : stage_names(names), stage_count(count < PROFILE_MAX_STAGES ? count : PROFILE_MAX_STAGES),
+			   last_period_start(0), report_enabled(false), report_line(0), window_start(0)
+{
+	reset();
+}
+
+
+void loop_profiler::reset()
+{
+	for ( byte i = 0; i < stage_count; ++i ) {
+		stages[i].min = 0xFFFFFFFF;
+		stages[i].max = 0;
+		stages[i].sum = 0;
+		stages[i].count = 0;
+	}
+	for ( byte i = 0; i < PROFILE_JITTER_BINS; ++i ) {
+		jitter[i] = 0;
+	}
+	window_start = hal::millis();
+}
+
+
+void loop_profiler::record( byte stage, uint32_t duration_us )
+{
+	stage_stats &s = stages[stage];
+
+	if ( duration_us < s.min ) {
+		s.min = duration_us;
+	}
+	if ( duration_us > s.max ) {
+		s.max = duration_us;
+	}
+	if ( s.count < 0xFFFF ) {
+		s.sum += duration_us;
+		++s.count;
+	}
+}
+
+
+void loop_profiler::record_period( uint32_t start_us, uint16_t period_ms )
+{
+	if ( last_period_start ) {
+		uint32_t actual_ms = (start_us - last_period_start) / 1000;
+		uint32_t error_ms = actual_ms > period_ms ? actual_ms - period_ms : period_ms - actual_ms;
+
+		// bin n holds errors below 2^n ms
+		byte bin = 0;
+		while ( bin < PROFILE_JITTER_BINS - 1 && error_ms >= (1UL << bin) ) {
+			++bin;
+		}
+		if ( jitter[bin] < 0xFFFF ) {
+			++jitter[bin];
+		}
+	}
+	last_period_start = start_us;
+}
+
+
+void loop_profiler::set_report( bool enabled )
+{
+	report_enabled = enabled;
+	report_line = 0;
+	reset();
+}
+
+
+bool loop_profiler::is_report_enabled() const
+{
+	return report_enabled;
+}
+
+
+void loop_profiler::report( Print &out )
+{
+	if ( !report_enabled ) {
+		return;
+	}
+	if ( report_line == 0 ) {
+		if ( hal::millis() - window_start < PROFILE_REPORT_MS ) {
+			return;
+		}
+		report_line = 1;
+	}
+	if ( out.availableForWrite() < PROFILE_LINE_MAX ) {
+		return;
+	}
+
+	// line 1: header, lines 2...stage_count+1: stages, last line: control period jitter
+	if ( report_line == 1 ) {
+		out.println(F("stage n min mean max [us]"));
+	} else if ( report_line <= stage_count + 1 ) {
+		const stage_stats &s = stages[report_line - 2];
+		out.print((const __FlashStringHelper *)pgm_read_ptr(&stage_names[report_line - 2]));
+		out.print(' ');
+		out.print(s.count);
+		out.print(' ');
+		out.print(s.count ? s.min : 0);
+		out.print(' ');
+		out.print(s.count ? s.sum / s.count : 0);
+		out.print(' ');
+		out.println(s.max);
+	} else {
+		out.print(F("jitter"));
+		for ( byte i = 0; i < PROFILE_JITTER_BINS; ++i ) {
+			out.print(' ');
+			out.print(jitter[i]);
+		}
+		out.println();
+		report_line = 0;
+		reset();
+		return;
+	}
+
+	++report_line;
+}
+
+
+#endif // PROFILER_HPP
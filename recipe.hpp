@@ -0,0 +1,109 @@
+#ifndef RECIPE_HPP
+#define RECIPE_HPP
+
+#include "hal.hpp"
+
+// Sterilization recipe: ramp, soak and cool segments run one after the other
+// by flow_control in OPERATION mode. Each segment moves the setpoint to its
+// target, at the ramp rate or at once, and holds it for the hold time:
+//
+//   heating segment (target above the start)   the hold starts when the oven reaches the target
+//   cooling segment (target below the start)   heater off, the hold starts when the oven is down at the target
+//
+// Targets are within the temperature range of the barrier (mode_control),
+// a cooling segment has no timeout and ambient is its floor.
+//
+// A segment is 4 bytes, a whole recipe fits the reserved bytes of the
+// parameter journal record (param_journal.hpp).
+
+#define RECIPE_MAX_SEGMENTS  3
+#define RECIPE_RATE_UNIT     10        // centi-degrees per minute of one rate count (0.1 C/min)
+#define RECIPE_SOAK_BAND     50        // centi-degrees below the target that count for the hold with RECIPE_SOAK_OVERLAP
+#define RECIPE_SIZE          (1 + 4 * RECIPE_MAX_SEGMENTS)   // serialized, count and segments
+
+// segment flags
+#define RECIPE_VENT_OFF      0x01      // vent relay off in this segment (on by default)
+#define RECIPE_SOAK_OVERLAP  0x02      // the hold starts RECIPE_SOAK_BAND below the target, while the ramp ends
+
+
+struct recipe_segment
+{
+	byte target;        // C
+	byte rate;          // RECIPE_RATE_UNIT, 0: no ramp, the setpoint steps to the target
+	byte hold;          // minutes
+	byte flags;
+};
+
+
+struct recipe
+{
+	byte count;         // segments in use, 0: no recipe stored
+	recipe_segment segments[RECIPE_MAX_SEGMENTS];
+};
+
+
+// A one segment recipe: heat up to temp_barier as fast as possible, hold it for time_barier
+inline void recipe_single( recipe &program, byte temp_barier, byte time_barier )
+{
+	program.count = 1;
+	program.segments[0].target = temp_barier;
+	program.segments[0].rate = 0;
+	program.segments[0].hold = time_barier;
+	program.segments[0].flags = 0;
+}
+
+
+// Highest target, C
+inline byte recipe_peak_target( const recipe &program )
+{
+	byte peak = 0;
+	for ( byte i = 0; i < program.count; ++i ) {
+		if ( program.segments[i].target > peak ) {
+			peak = program.segments[i].target;
+		}
+	}
+	return peak;
+}
+
+
+// Sum of the holds, minutes
+inline uint16_t recipe_total_hold( const recipe &program )
+{
+	uint16_t hold = 0;
+	for ( byte i = 0; i < program.count; ++i ) {
+		hold += program.segments[i].hold;
+	}
+	return hold;
+}
+
+
+inline void recipe_encode( const recipe &program, byte *data )
+{
+	data[0] = program.count;
+	for ( byte i = 0; i < RECIPE_MAX_SEGMENTS; ++i ) {
+		const recipe_segment &segment = program.segments[i];
+		byte *field = data + 1 + 4 * i;
+		field[0] = segment.target;
+		field[1] = segment.rate;
+		field[2] = segment.hold;
+		field[3] = segment.flags;
+	}
+}
+
+
+inline void recipe_decode( const byte *data, recipe &program )
+{
+	// reserved bytes of older records read as 0xFF, no recipe
+	program.count = data[0] <= RECIPE_MAX_SEGMENTS ? data[0] : 0;
+	for ( byte i = 0; i < RECIPE_MAX_SEGMENTS; ++i ) {
+		recipe_segment &segment = program.segments[i];
+		const byte *field = data + 1 + 4 * i;
+		segment.target = field[0];
+		segment.rate = field[1];
+		segment.hold = field[2];
+		segment.flags = field[3];
+	}
+}
+
+
+#endif // RECIPE_HPP
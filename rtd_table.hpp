@@ -0,0 +1,108 @@
+#ifndef RTD_TABLE_HPP
+#define RTD_TABLE_HPP
+
+#include "hal.hpp"
+
+// PT100 conversion table, raw 15-bit MAX31865 RTD code -> centi-degrees.
+// The table is computed by the compiler from the Callendar-Van Dusen equation
+// for the RREF of the board (RREF must be defined before this header is included),
+// stored in flash and linearly interpolated with integer math at run time.
+
+#ifndef RREF
+	#error "RREF (reference resistor value) must be defined before including rtd_table.hpp"
+#endif
+
+#define RTD_NOMINAL       100.0    // PT100
+
+#define RTD_TABLE_SHIFT   7                          // 128 codes (~4.4 C) between table entries
+#define RTD_TABLE_STEP    (1 << RTD_TABLE_SHIFT)
+#define RTD_TABLE_FIRST   5632                       // ~76 Ohm, ~ -61 C with RREF 430...440
+#define RTD_TABLE_SIZE    81                         // up to ~212 Ohm, ~ +300 C
+#define RTD_TABLE_LAST    (RTD_TABLE_FIRST + (RTD_TABLE_SIZE - 1) * RTD_TABLE_STEP)
+
+
+namespace rtd
+{
+	// Callendar-Van Dusen coefficients (IEC 60751)
+	constexpr double CVD_A = 3.9083e-3;
+	constexpr double CVD_B = -5.775e-7;
+
+	// Newton iteration, constexpr replacement for sqrt()
+	constexpr double sqrt_iter( double x, double guess, int n )
+	{
+		return n == 0 ? guess : sqrt_iter(x, 0.5 * (guess + x / guess), n - 1);
+	}
+
+	constexpr double sqrt( double x )
+	{
+		return sqrt_iter(x, x > 1.0 ? x : 1.0, 40);
+	}
+
+	constexpr double resistance( uint16_t code )
+	{
+		return code * (RREF) / 32768.0;
+	}
+
+	// Below 0 C the quadratic is not valid, use the same polynomial fit as the Adafruit library
+	constexpr double negative_polynomial( double x )
+	{
+		return -242.02 + x * (2.2228 + x * (2.5859e-3 + x * (-4.8260e-6 + x * (-2.8183e-8 + x * 1.5243e-10))));
+	}
+
+	constexpr double temperature( double r )
+	{
+		return r >= RTD_NOMINAL
+			   ? (sqrt(CVD_A * CVD_A - 4.0 * CVD_B + 4.0 * CVD_B / RTD_NOMINAL * r) - CVD_A) / (2.0 * CVD_B)
+			   : negative_polynomial(r * 100.0 / RTD_NOMINAL);
+	}
+
+	constexpr int16_t round_centi( double t )
+	{
+		return int16_t( t * 100.0 + (t >= 0 ? 0.5 : -0.5) );
+	}
+
+	constexpr int16_t centi_degrees_exact( uint16_t code )
+	{
+		return round_centi( temperature(resistance(code)) );
+	}
+
+	#define RTD_ENTRY(i)  rtd::centi_degrees_exact( RTD_TABLE_FIRST + (i) * RTD_TABLE_STEP )
+	#define RTD_ROW(i)    RTD_ENTRY(i), RTD_ENTRY(i + 1), RTD_ENTRY(i + 2), RTD_ENTRY(i + 3), \
+						  RTD_ENTRY(i + 4), RTD_ENTRY(i + 5), RTD_ENTRY(i + 6), RTD_ENTRY(i + 7)
+
+	const int16_t table[RTD_TABLE_SIZE] PROGMEM = {
+		RTD_ROW(0),  RTD_ROW(8),  RTD_ROW(16), RTD_ROW(24), RTD_ROW(32),
+		RTD_ROW(40), RTD_ROW(48), RTD_ROW(56), RTD_ROW(64), RTD_ROW(72),
+		RTD_ENTRY(80)
+	};
+
+	#undef RTD_ROW
+	#undef RTD_ENTRY
+
+
+	// Raw 15-bit RTD code (Adafruit_MAX31865::readRTD()) to centi-degrees, clamped to the table range
+	inline int16_t to_centi_degrees( uint16_t code )
+	{
+		if ( code <= RTD_TABLE_FIRST ) {
+			return pgm_read_word(&table[0]);
+		}
+		if ( code >= RTD_TABLE_LAST ) {
+			return pgm_read_word(&table[RTD_TABLE_SIZE - 1]);
+		}
+
+		uint16_t offset = code - RTD_TABLE_FIRST;
+		byte index = offset >> RTD_TABLE_SHIFT;
+		byte fraction = offset & (RTD_TABLE_STEP - 1);
+
+		int16_t t0 = pgm_read_word(&table[index]);
+		int16_t t1 = pgm_read_word(&table[index + 1]);
+
+		// the table is monotonic and entries are less than 512 apart, the product fits 16 bits
+		uint16_t step = (uint16_t)(t1 - t0) * fraction + (RTD_TABLE_STEP >> 1);
+
+		return t0 + (int16_t)(step >> RTD_TABLE_SHIFT);
+	}
+}
+
+
+#endif // RTD_TABLE_HPP
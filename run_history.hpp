@@ -0,0 +1,394 @@
+#ifndef RUN_HISTORY_HPP
+#define RUN_HISTORY_HPP
+
+#include "hal.hpp"
+
+// Temperature profile and heater activity of the running cycle, in RAM.
+// Every HISTORY_INTERVAL_MS one sample is appended: the temperature change
+// since the last sample in 0.1 C (zigzag) and the mean heater duty of the
+// interval in eighths, packed as (zigzag << 3 | duty) into a base-128 varint.
+// A slow oven moves less than 0.8 C between samples, so a sample is one byte.
+// When the buffer is full neighbouring samples are merged pairwise and the
+// interval doubles: a run of any length fits, 240 minutes at 80 s per
+// sample. Appending a sample is a few shifts and one byte store; the merge
+// walks the buffer once, a handful of times per run.
+//
+// The first sample holds the start temperature, the summary of the cycle
+// (cycle_log.hpp) is kept alongside.
+
+#define HISTORY_SIZE         256      // bytes of samples
+#define HISTORY_INTERVAL_MS  10000    // sample interval at the start of a run
+#define HISTORY_VARINT_MAX   3        // bytes of the largest sample
+#define HISTORY_DUTY_LEVELS  8        // heater duty 0...7/7
+
+// cycle results
+#define HISTORY_RUNNING   0
+#define HISTORY_FINISHED  1
+#define HISTORY_ABORTED   2           // stopped by the user
+#define HISTORY_FAULT     3           // stopped by a sensor fault or the temperature range
+
+
+// Summary of one cycle
+struct cycle_summary
+{
+	byte result;
+	byte target;            // highest target, C
+	byte hold;              // hold minutes, summed over the recipe
+	byte start_temp;        // C
+	byte heater_percent;    // mean heater duty over the cycle
+	int16_t peak_temp;      // centi-degrees
+	uint16_t arrival;       // s from the start to the first arrival at a target, 0xFFFF if never
+	uint16_t duration;      // s
+};
+
+
+// Read position in the samples
+struct history_reader
+{
+	uint16_t pos;
+	uint16_t index;
+	int16_t temp;           // 0.1 C
+};
+
+
+class run_history
+{
+	public:
+		run_history();
+
+		void start( int16_t temp, byte target, byte hold );   // temp in centi-degrees
+		void sample( int16_t temp, byte duty, bool arrived );  // every control task while running
+		void finish( byte result );
+
+		bool is_running() const;
+		const cycle_summary &get_summary() const;   // of the running or the last cycle
+
+		uint16_t get_count() const;                 // samples
+		uint16_t get_size() const;                  // bytes in use
+		uint32_t get_interval() const;              // ms between samples
+
+		// Decoding: rewind, then next() until it returns false; temp in 0.1 C, duty 0...255
+		void rewind( history_reader &reader ) const;
+		bool next( history_reader &reader, int16_t &temp, byte &duty ) const;
+
+#if defined(ARDUINO)
+		void start_dump();
+		bool dump( Print &out );                    // at most one line per call, false when done; starts over
+		                                            // with its header when a merge or a new cycle rewrites the buffer
+#endif
+
+	private:
+		void append( int16_t temp, byte level );
+		void merge();
+		static byte level_of( uint32_t value );
+		void put( uint32_t value );
+		uint32_t get( uint16_t &pos ) const;
+		static uint16_t zigzag( int16_t value );
+		static int16_t unzigzag( uint16_t value );
+
+	protected:
+		byte data[HISTORY_SIZE];
+		uint16_t used;
+		uint16_t count;
+		uint32_t interval;
+
+		int16_t last_temp;               // 0.1 C, of the last sample
+		uint32_t last_time;              // end of the last sample
+		uint32_t start_time;
+		uint32_t duty_sum;               // this interval
+		uint16_t duty_count;
+		uint32_t pending_time;           // ms of a sample taken back by a merge, it joins the next one
+		byte pending_level;
+		uint32_t cycle_duty_sum;         // whole cycle
+		uint32_t cycle_duty_count;
+		cycle_summary summary;
+
+#if defined(ARDUINO)
+		history_reader dump_reader;
+		byte dump_line;                  // 0 idle, 1 header, 2 samples
+#endif
+};
+
+
+run_history::run_history()
+		   : used(0), count(0), interval(HISTORY_INTERVAL_MS)
+{
+	summary.result = HISTORY_ABORTED;
+#if defined(ARDUINO)
+	dump_line = 0;
+#endif
+}
+
+
+void run_history::start( int16_t temp, byte target, byte hold )
+{
+	used = 0;
+	count = 0;
+	interval = HISTORY_INTERVAL_MS;
+	last_temp = 0;
+	start_time = hal::millis();
+	last_time = start_time;
+	duty_sum = 0;
+	duty_count = 0;
+	pending_time = 0;
+	cycle_duty_sum = 0;
+	cycle_duty_count = 0;
+
+	summary.result = HISTORY_RUNNING;
+	summary.target = target;
+	summary.hold = hold;
+	summary.start_temp = temp < 0 ? 0 : temp > 25500 ? 255 : temp / 100;
+	summary.heater_percent = 0;
+	summary.peak_temp = temp;
+	summary.arrival = 0xFFFF;
+	summary.duration = 0;
+
+	append( temp / 10, 0 );   // the first delta is the start temperature
+
+#if defined(ARDUINO)
+	if ( dump_line ) {
+		start_dump();           // the buffer of the last cycle is gone, the dump starts over
+	}
+#endif
+}
+
+
+void run_history::sample( int16_t temp, byte duty, bool arrived )
+{
+	if ( summary.result != HISTORY_RUNNING ) {
+		return;
+	}
+
+	if ( temp > summary.peak_temp ) {
+		summary.peak_temp = temp;
+	}
+	if ( arrived && summary.arrival == 0xFFFF ) {
+		summary.arrival = (hal::millis() - start_time) / 1000;
+	}
+
+	duty_sum += duty;
+	++duty_count;
+	cycle_duty_sum += duty;
+	++cycle_duty_count;
+
+	if ( hal::millis() - last_time >= interval ) {
+		byte level = (duty_sum * (HISTORY_DUTY_LEVELS - 1) + duty_count * 255 / 2) / ((uint32_t)duty_count * 255);
+		if ( pending_time ) {
+			level = (pending_level * pending_time + level * (interval - pending_time) + interval / 2) / interval;
+			pending_time = 0;
+		}
+		last_time += interval;
+		duty_sum = 0;
+		duty_count = 0;
+		append( temp / 10, level );
+	}
+}
+
+
+void run_history::finish( byte result )
+{
+	if ( summary.result != HISTORY_RUNNING ) {
+		return;
+	}
+	uint32_t seconds = (hal::millis() - start_time) / 1000;
+	summary.result = result;
+	summary.duration = seconds > 0xFFFF ? 0xFFFF : seconds;
+	summary.heater_percent = cycle_duty_count ? cycle_duty_sum / cycle_duty_count * 100 / 255 : 0;
+}
+
+
+bool run_history::is_running() const
+{
+	return summary.result == HISTORY_RUNNING;
+}
+
+
+const cycle_summary &run_history::get_summary() const
+{
+	return summary;
+}
+
+
+uint16_t run_history::get_count() const
+{
+	return count;
+}
+
+
+uint16_t run_history::get_size() const
+{
+	return used;
+}
+
+
+uint32_t run_history::get_interval() const
+{
+	return interval;
+}
+
+
+void run_history::rewind( history_reader &reader ) const
+{
+	reader.pos = 0;
+	reader.index = 0;
+	reader.temp = 0;
+}
+
+
+bool run_history::next( history_reader &reader, int16_t &temp, byte &duty ) const
+{
+	if ( reader.index >= count ) {
+		return false;
+	}
+	uint32_t value = get( reader.pos );
+	reader.temp += unzigzag( value >> 3 );
+	++reader.index;
+
+	temp = reader.temp;
+	duty = (uint16_t)level_of(value) * 255 / (HISTORY_DUTY_LEVELS - 1);
+	return true;
+}
+
+
+void run_history::append( int16_t temp, byte level )
+{
+	put( (uint32_t)zigzag(temp - last_temp) << 3 | level );
+	last_temp = temp;
+	++count;
+
+	// room for the next sample is always left
+	while ( used + HISTORY_VARINT_MAX > HISTORY_SIZE ) {
+		merge();
+	}
+}
+
+
+void run_history::merge()
+{
+	// The start temperature stays alone, the rest merges pairwise in place:
+	// a merged varint is never longer than the two it replaces. A last sample
+	// without a partner is taken back, it joins the sample that comes next.
+	uint16_t in = 0;
+	uint32_t first = get( in );
+	used = 0;
+	put( first );
+
+	uint16_t merged = 1;
+	uint16_t i = 1;
+	for ( ; i + 1 < count; i += 2 ) {
+		uint32_t a = get( in );
+		uint32_t b = get( in );
+		int16_t delta = unzigzag( a >> 3 ) + unzigzag( b >> 3 );
+		put( (uint32_t)zigzag(delta) << 3 | ((level_of(a) + level_of(b) + 1) >> 1) );
+		++merged;
+	}
+	if ( i < count ) {
+		uint32_t tail = get( in );
+		last_temp -= unzigzag( tail >> 3 );
+		pending_level = (pending_level * pending_time + level_of(tail) * interval + (pending_time + interval) / 2) /
+						(pending_time + interval);
+		pending_time += interval;
+		last_time -= interval;
+	}
+
+	count = merged;
+	interval *= 2;
+
+#if defined(ARDUINO)
+	if ( dump_line ) {
+		start_dump();           // positions and interval of the lines sent so far are stale, the dump starts over
+	}
+#endif
+}
+
+
+byte run_history::level_of( uint32_t value )
+{
+	return value & (HISTORY_DUTY_LEVELS - 1);
+}
+
+
+void run_history::put( uint32_t value )
+{
+	while ( value >= 0x80 ) {
+		data[used++] = value | 0x80;
+		value >>= 7;
+	}
+	data[used++] = value;
+}
+
+
+uint32_t run_history::get( uint16_t &pos ) const
+{
+	uint32_t value = 0;
+	byte shift = 0;
+	byte b;
+	do {
+		b = data[pos++];
+		value |= (uint32_t)(b & 0x7F) << shift;
+		shift += 7;
+	} while ( b & 0x80 );
+	return value;
+}
+
+
+uint16_t run_history::zigzag( int16_t value )
+{
+	return ((uint16_t)value << 1) ^ (uint16_t)(value >> 15);
+}
+
+
+int16_t run_history::unzigzag( uint16_t value )
+{
+	return (int16_t)(value >> 1) ^ -(int16_t)(value & 1);
+}
+
+
+#if defined(ARDUINO)
+void run_history::start_dump()
+{
+	dump_line = 1;
+	rewind( dump_reader );
+}
+
+
+bool run_history::dump( Print &out )
+{
+	if ( !dump_line ) {
+		return false;
+	}
+	if ( out.availableForWrite() < 24 ) {
+		return true;
+	}
+
+	if ( dump_line == 1 ) {
+		// header: interval in s, samples, bytes
+		out.print(F("history "));
+		out.print(interval / 1000);
+		out.print(' ');
+		out.print(count);
+		out.print(' ');
+		out.println(used);
+		dump_line = 2;
+		return true;
+	}
+
+	// sample lines: s since the start, temperature in 0.1 C, heater duty
+	int16_t temp;
+	byte duty;
+	uint16_t index = dump_reader.index;
+	if ( !next( dump_reader, temp, duty ) ) {
+		dump_line = 0;
+		return false;
+	}
+	out.print( index * (interval / 1000) );
+	out.print(' ');
+	out.print( temp );
+	out.print(' ');
+	out.println( duty );
+	return true;
+}
+#endif
+
+
+#endif // RUN_HISTORY_HPP
@@ -0,0 +1,302 @@
+#ifndef SAFETY_MONITOR_HPP
+#define SAFETY_MONITOR_HPP
+
+#include "hal.hpp"
+#include "thermal_model.hpp"
+
+#if defined(ARDUINO)
+	#include <avr/wdt.h>
+#endif
+
+// Plausibility checks of the chamber temperatures against their heaters, next
+// to the MAX31865 fault bits and the hard temperature limits. sample() runs at
+// the full sensor rate and costs a few compares per sample, every check keeps
+// one reference value and one time stamp per zone, one array per field; the
+// model is asked only when a check arms. The first fault of any zone latches
+// until clear(); the sketch switches to mode 3 on it.
+//
+//   SAFETY_TOO_FAST  the reading rose more than SAFETY_MAX_STEP in SAFETY_STEP_MS, faster than the heater
+//                    can drive it, a loose probe contact (a door or a cold load can make it fall fast)
+//   SAFETY_NO_RISE   the heater driven above the duty that holds the temperature without a rise of
+//                    SAFETY_RISE_MIN above the lowest reading in time, a probe out of the chamber, a heater
+//                    or relay that does not switch on; a door left open long enough trips it as well
+//   SAFETY_STALLED   the raw reading unchanged for SAFETY_STALL_MS while the heater is driven, a frozen
+//                    converter or bus
+//   SAFETY_OFF_RISE  SAFETY_OFF_RISE_MAX above the coast peak the model predicts when the heater went off,
+//                    or above the lowest reading once the coast is over, a welded relay
+//   SAFETY_WATCHDOG  the last reset came from the hardware watchdog, the loop hung
+//
+// With a valid oven model (set_model(), thermal_model.hpp) the rise check arms
+// at SAFETY_ARM_DUTY and above once the duty exceeds the steady duty of the
+// temperature by SAFETY_EXCESS_MIN, also during a hold. Its window is the dead
+// time plus SAFETY_RISE_SLACK times the time the model needs for
+// SAFETY_RISE_MIN at half the excess. Without one it arms at full duty only,
+// and both rise checks wait their fixed times, longer than the heater to probe
+// dead time of any oven. Only zone 0 learns a model (flow_control.hpp), the
+// followers keep the fixed times.
+
+#define SAFETY_STEP_MS        1000      // ms between the checks of the rate
+#define SAFETY_MAX_STEP       500       // centi-degrees per SAFETY_STEP_MS, the heater gives ~0.2 C/s
+#define SAFETY_HEAT_DUTY      255       // heater duty at which the temperature must rise, a hold never needs full power
+#define SAFETY_RISE_MS        240000UL  // at SAFETY_HEAT_DUTY, and the longest window with a model
+#define SAFETY_RISE_MIN       100       // centi-degrees
+#define SAFETY_ARM_DUTY       64        // lowest duty of the model based rise check, a quarter of full power
+#define SAFETY_EXCESS_MIN     32        // duty above the steady duty of the temperature
+#define SAFETY_RISE_SLACK     2         // times the rise time of the model
+#define SAFETY_STALL_MS       120000UL
+#define SAFETY_OFF_SETTLE_MS  120000UL  // the coast after the heater went off
+#define SAFETY_OFF_RISE_MAX   300       // centi-degrees
+#define SAFETY_WATCHDOG_TIME  WDTO_1S   // loop() must kick the watchdog within
+
+// faults
+#define SAFETY_OK         0
+#define SAFETY_TOO_FAST   1
+#define SAFETY_NO_RISE    2
+#define SAFETY_STALLED    3
+#define SAFETY_OFF_RISE   4
+#define SAFETY_WATCHDOG   5
+
+
+// N: zones, each checked against its own heater duty (zone_bank.hpp)
+template <byte N>
+class safety_monitor
+{
+	public:
+		safety_monitor();
+
+		void init();                                          // watchdog started on the Arduino, reset cause checked
+		void kick();                                          // to be called in every loop() pass
+
+		void set_model( byte zone, const thermal_model *model );   // oven model of a chamber, 0 for the fixed times
+
+		// Every sensor sample of a zone without a converter fault: filtered temperature in
+		// centi-degrees, the raw reading and the heater duty 0...255 the control asks for
+		void sample( byte zone, int16_t temp, uint16_t raw, byte duty );
+
+		byte get_fault() const;                               // SAFETY_*, the first one of any zone
+		byte get_fault_zone() const;                          // zone of that fault
+		void clear();                                         // fault acknowledged, the checks start over
+
+	private:
+		void trip( byte zone, byte fault );
+		bool arm_rise( byte zone, int16_t temp, byte duty );
+
+	protected:
+		const thermal_model *model[N];
+		byte fault;
+		byte fault_zone;
+		byte primed;                     // bit mask of the zones with a first sample
+		byte rise_armed;                 // bit mask of the zones with the heater at rise_duty or above
+		byte off_armed;                  // bit mask of the zones with the coast peak predicted or the heater off for SAFETY_OFF_SETTLE_MS
+
+		int16_t step_temp[N];            // reading at the last rate check
+		uint32_t step_time[N];
+
+		byte rise_duty[N];               // lowest duty the window holds for
+		int16_t rise_from[N];            // lowest reading since the last rise
+		uint32_t rise_since[N];
+		uint32_t rise_window[N];
+
+		uint16_t stall_raw[N];
+		uint32_t stall_since[N];         // the reading unchanged and the heater driven since
+
+		int16_t off_limit[N];            // predicted peak, then the lowest reading
+		uint32_t off_since[N];           // the heater off since
+};
+
+
+#if defined(ARDUINO)
+// Reset cause, taken before the C runtime clears the RAM (.noinit). Stock Optiboot
+// clears MCUSR before it starts the sketch and passes its value in r2; without a
+// bootloader MCUSR still holds it, always non-zero after a reset. A watchdog reset
+// leaves the watchdog running with its shortest timeout, it is switched off here
+// before setup() and its delays, safety_monitor<N>::init() starts it again.
+byte safety_reset_flags __attribute__((section(".noinit")));
+
+void safety_save_reset_flags() __attribute__((naked, used, section(".init3")));
+void safety_save_reset_flags()
+{
+	__asm__ __volatile__ ( "sts %0, r2" : "=m" (safety_reset_flags) );
+	if ( MCUSR ) {
+		safety_reset_flags = MCUSR;
+	}
+	MCUSR = 0;
+	wdt_disable();
+}
+#endif
+
+
+template <byte N>
+safety_monitor<N>::safety_monitor()
+			  : fault(SAFETY_OK), fault_zone(0), primed(0), rise_armed(0), off_armed(0)
+{
+	static_assert(N >= 1 && N <= 8, "1...8 zones in the bit masks");
+	for ( byte zone = 0; zone < N; ++zone ) {
+		model[zone] = 0;
+	}
+}
+
+
+template <byte N>
+void safety_monitor<N>::init()
+{
+#if defined(ARDUINO)
+	// a watchdog reset stays a fault until acknowledged
+	if ( safety_reset_flags & _BV(WDRF) ) {
+		fault = SAFETY_WATCHDOG;
+	}
+	wdt_enable(SAFETY_WATCHDOG_TIME);
+#endif
+}
+
+
+template <byte N>
+void safety_monitor<N>::kick()
+{
+#if defined(ARDUINO)
+	wdt_reset();
+#endif
+}
+
+
+template <byte N>
+void safety_monitor<N>::set_model( byte zone, const thermal_model *value )
+{
+	model[zone] = value;
+}
+
+
+template <byte N>
+void safety_monitor<N>::sample( byte zone, int16_t temp, uint16_t raw, byte duty )
+{
+	uint32_t now = hal::millis();
+	byte bit = 1 << zone;
+
+	if ( !(primed & bit) ) {
+		primed |= bit;
+		step_temp[zone] = temp;
+		step_time[zone] = now;
+		rise_armed &= ~bit;
+		stall_raw[zone] = raw;
+		stall_since[zone] = now;
+		off_armed &= ~bit;
+		off_since[zone] = now;
+	}
+
+	bool step = now - step_time[zone] >= SAFETY_STEP_MS;
+	if ( step ) {
+		if ( temp - step_temp[zone] > SAFETY_MAX_STEP ) {
+			trip( zone, SAFETY_TOO_FAST );
+		}
+		step_temp[zone] = temp;
+		step_time[zone] = now;
+	}
+
+	if ( (rise_armed & bit) && (duty < rise_duty[zone] || temp >= rise_from[zone] + SAFETY_RISE_MIN) ) {
+		rise_armed &= ~bit;   // less heat than the window was set for, or the rise came
+	}
+	if ( !(rise_armed & bit) ) {
+		// the model is asked at most once per rate step
+		if ( duty >= SAFETY_HEAT_DUTY || (step && duty >= SAFETY_ARM_DUTY) ) {
+			if ( arm_rise( zone, temp, duty ) ) {
+				rise_armed |= bit;
+			}
+			rise_from[zone] = temp;
+			rise_since[zone] = now;
+		}
+	} else {
+		if ( temp < rise_from[zone] ) {
+			rise_from[zone] = temp;    // the rise counts from the lowest reading
+		}
+		if ( now - rise_since[zone] >= rise_window[zone] ) {
+			trip( zone, SAFETY_NO_RISE );
+		}
+	}
+
+	if ( !duty || raw != stall_raw[zone] ) {
+		stall_raw[zone] = raw;
+		stall_since[zone] = now;
+	} else if ( now - stall_since[zone] >= SAFETY_STALL_MS ) {
+		trip( zone, SAFETY_STALLED );
+	}
+
+	if ( duty ) {
+		off_armed &= ~bit;
+		off_since[zone] = now;
+	} else {
+		bool settled = now - off_since[zone] >= SAFETY_OFF_SETTLE_MS;
+		if ( !(off_armed & bit) ) {
+			if ( settled || (model[zone] && model[zone]->is_valid()) ) {
+				off_armed |= bit;
+				off_limit[zone] = settled ? temp : model[zone]->predict_peak(temp, 0);   // once, when the heater went off
+			}
+		} else if ( settled && temp < off_limit[zone] ) {
+			off_limit[zone] = temp;    // after the coast the rise counts from the lowest reading
+		}
+		if ( (off_armed & bit) && temp - off_limit[zone] > SAFETY_OFF_RISE_MAX ) {
+			trip( zone, SAFETY_OFF_RISE );
+		}
+	}
+}
+
+
+template <byte N>
+byte safety_monitor<N>::get_fault() const
+{
+	return fault;
+}
+
+
+template <byte N>
+byte safety_monitor<N>::get_fault_zone() const
+{
+	return fault_zone;
+}
+
+
+template <byte N>
+void safety_monitor<N>::clear()
+{
+	fault = SAFETY_OK;
+	fault_zone = 0;
+	primed = 0;
+}
+
+
+template <byte N>
+bool safety_monitor<N>::arm_rise( byte zone, int16_t temp, byte duty )
+{
+	const thermal_model *oven = model[zone];
+	rise_duty[zone] = SAFETY_HEAT_DUTY;
+	rise_window[zone] = SAFETY_RISE_MS;
+
+	if ( oven && oven->is_valid() ) {
+		byte steady = oven->steady_duty(temp);
+		int16_t half = (duty - steady) / 2;
+		if ( half >= SAFETY_EXCESS_MIN / 2 ) {
+			// at half the excess the model gives gain * half / 255 / tau per second, in ms for SAFETY_RISE_MIN
+			uint64_t rise_ms = (uint64_t)SAFETY_RISE_SLACK * SAFETY_RISE_MIN * oven->get_time_constant() * 1000 * PID_OUT_MAX /
+							   ((uint64_t)oven->get_gain() * half);
+			uint32_t window = oven->get_dead_time() + (rise_ms < SAFETY_RISE_MS ? rise_ms : SAFETY_RISE_MS);
+			if ( window < SAFETY_RISE_MS ) {
+				rise_duty[zone] = steady + half > SAFETY_ARM_DUTY ? steady + half : SAFETY_ARM_DUTY;
+				rise_window[zone] = window;
+			}
+		}
+	}
+
+	return duty >= rise_duty[zone];
+}
+
+
+template <byte N>
+void safety_monitor<N>::trip( byte zone, byte value )
+{
+	if ( fault == SAFETY_OK ) {
+		fault = value;
+		fault_zone = zone;
+	}
+}
+
+
+#endif // SAFETY_MONITOR_HPP
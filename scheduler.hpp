@@ -0,0 +1,152 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "hal.hpp"
+
+// Cooperative periodic task scheduler with a static task table.
+// Tasks are registered in priority order (first added = highest priority).
+// run() starts at most one task per call, the highest priority one that is due,
+// so a long low priority task (display) can delay a high priority one (control)
+// by at most its own run time, never by a whole pass over all tasks.
+// A task started a full period or more after its release time counts as a
+// deadline miss, the missed activations are skipped.
+
+typedef void (*task_function)();
+
+#define TASK_ON_DEMAND  0        // period of tasks that run only when triggered
+
+
+template <byte MAX_TASKS>
+class task_scheduler
+{
+	public:
+		task_scheduler();
+
+		// register a task, returns its id (== priority, 0 is the highest)
+		byte add( task_function function, uint16_t period_ms, uint16_t offset_ms = 0 );
+
+		void trigger( byte id );               // run the task as soon as possible (on demand tasks)
+
+		// new period, TASK_ON_DEMAND suspends the task; the next release is now, on the new period from there
+		void set_period( byte id, uint16_t period_ms );
+
+		// Handler, to be called in the loop(), returns false if no task was due
+		bool run();
+
+		uint16_t get_misses( byte id ) const;       // deadline misses since start
+		uint16_t get_max_lateness( byte id ) const; // worst start delay after release, ms
+
+	protected:
+		struct task_t {
+			task_function function;
+			uint16_t period;             // ms, TASK_ON_DEMAND for triggered tasks
+			uint32_t release;            // next release time, ms
+			uint16_t misses;
+			uint16_t max_lateness;
+			bool triggered;
+		};
+
+		task_t tasks[MAX_TASKS];
+		byte task_count;
+};
+
+
+template <byte MAX_TASKS>
+task_scheduler<MAX_TASKS>::task_scheduler()
+			  : task_count(0)
+{
+
+}
+
+
+template <byte MAX_TASKS>
+byte task_scheduler<MAX_TASKS>::add( task_function function, uint16_t period_ms, uint16_t offset_ms )
+{
+	if ( task_count >= MAX_TASKS ) {
+		return MAX_TASKS;
+	}
+
+	task_t &task = tasks[task_count];
+	task.function = function;
+	task.period = period_ms;
+	task.release = hal::millis() + offset_ms;
+	task.misses = 0;
+	task.max_lateness = 0;
+	task.triggered = false;
+
+	return task_count++;
+}
+
+
+template <byte MAX_TASKS>
+void task_scheduler<MAX_TASKS>::trigger( byte id )
+{
+	if ( id < task_count ) {
+		tasks[id].triggered = true;
+	}
+}
+
+
+template <byte MAX_TASKS>
+void task_scheduler<MAX_TASKS>::set_period( byte id, uint16_t period_ms )
+{
+	if ( id < task_count && tasks[id].period != period_ms ) {
+		tasks[id].period = period_ms;
+		tasks[id].release = hal::millis();
+	}
+}
+
+
+template <byte MAX_TASKS>
+bool task_scheduler<MAX_TASKS>::run()
+{
+	uint32_t now = hal::millis();
+
+	for ( byte id = 0; id < task_count; ++id ) {
+		task_t &task = tasks[id];
+
+		if ( task.triggered ) {
+			task.triggered = false;
+			task.function();
+			return true;
+		}
+
+		if ( task.period == TASK_ON_DEMAND || (int32_t)(now - task.release) < 0 ) {
+			continue;
+		}
+
+		uint32_t lateness = now - task.release;
+		if ( lateness > task.max_lateness ) {
+			task.max_lateness = lateness > 0xFFFF ? 0xFFFF : lateness;
+		}
+
+		if ( lateness >= task.period ) {
+			// skip the missed activations, keep the original phase
+			++task.misses;
+			task.release += (lateness / task.period) * task.period;
+		}
+		task.release += task.period;
+
+		task.function();
+		return true;
+	}
+
+	return false;
+}
+
+
+template <byte MAX_TASKS>
+uint16_t task_scheduler<MAX_TASKS>::get_misses( byte id ) const
+{
+	return id < task_count ? tasks[id].misses : 0;
+}
+
+
+template <byte MAX_TASKS>
+uint16_t task_scheduler<MAX_TASKS>::get_max_lateness( byte id ) const
+{
+	return id < task_count ? tasks[id].max_lateness : 0;
+}
+
+
+#endif // SCHEDULER_HPP
@@ -0,0 +1,188 @@
+#ifndef SENSOR_FILTER_HPP
+#define SENSOR_FILTER_HPP
+
+#include "hal.hpp"
+
+// Integer temperature filter stages, samples in centi-degrees.
+// Every stage has the same interface, so a pipeline is put together at
+// compile time from filter_chain<> and the stage templates:
+//
+//   filter_chain< median_filter<5>, iir_filter<3> > filter;
+//
+//   reset(x)        start from a steady input x (first sample)
+//   update(x)       one new sample, returns the filtered value
+//   group_delay()   low frequency delay of the stage, in 1/16 samples (FILTER_DELAY_ONE)
+
+#define FILTER_DELAY_SHIFT  4
+#define FILTER_DELAY_ONE    (1 << FILTER_DELAY_SHIFT)   // group delay of one sample
+
+
+// Median of the last N samples, rejects single sample spikes (up to (N - 1) / 2 in a row)
+template <byte N>
+class median_filter
+{
+	public:
+		median_filter() : head(0) {}
+
+		void reset( int16_t x );
+		int16_t update( int16_t x );
+		uint16_t group_delay() const { return (N - 1) * FILTER_DELAY_ONE / 2; }
+
+	protected:
+		int16_t window[N];
+		byte head;               // oldest sample
+};
+
+
+// First order exponential smoothing y += (x - y) / 2^SHIFT, time constant about 2^SHIFT samples
+template <byte SHIFT>
+class iir_filter
+{
+	public:
+		iir_filter() : state(0) {}
+
+		void reset( int16_t x )          { state = (int32_t)x * (1 << SHIFT); }
+		int16_t update( int16_t x );
+		uint16_t group_delay() const     { return ((1 << SHIFT) - 1) * FILTER_DELAY_ONE; }
+
+	protected:
+		int32_t state;           // output with SHIFT fraction bits, no truncation drift
+};
+
+
+// Scalar Kalman filter for a slowly drifting temperature (random walk model).
+// Q: process noise variance per sample, R: measurement noise variance, both in centi-degrees^2.
+// The gain settles at the value that matches the two, the group delay follows it.
+template <uint16_t Q, uint16_t R>
+class kalman_filter
+{
+	public:
+		kalman_filter() : estimate(0), variance(0), gain(0) {}
+
+		void reset( int16_t x );
+		int16_t update( int16_t x );
+		uint16_t group_delay() const;
+
+	protected:
+		int32_t estimate;        // centi-degrees, 8 fraction bits
+		uint32_t variance;       // estimate variance, 8 fraction bits
+		uint16_t gain;           // last Kalman gain, 0...65535 == 0...1
+};
+
+
+// Pass-through stage, for optional stages switched off at compile time
+class no_filter
+{
+	public:
+		void reset( int16_t ) {}
+		int16_t update( int16_t x )      { return x; }
+		uint16_t group_delay() const     { return 0; }
+};
+
+
+// Two stages in series, chains nest: filter_chain< A, filter_chain<B, C> >
+template <class FIRST, class SECOND>
+class filter_chain
+{
+	public:
+		void reset( int16_t x )          { first.reset(x); second.reset(x); }
+		int16_t update( int16_t x )      { return second.update(first.update(x)); }
+		uint16_t group_delay() const     { return first.group_delay() + second.group_delay(); }
+
+	protected:
+		FIRST first;
+		SECOND second;
+};
+
+
+/////////////////////////////////////////////////////////////// median_filter
+
+template <byte N>
+void median_filter<N>::reset( int16_t x )
+{
+	for ( byte i = 0; i < N; ++i ) {
+		window[i] = x;
+	}
+	head = 0;
+}
+
+
+template <byte N>
+int16_t median_filter<N>::update( int16_t x )
+{
+	window[head] = x;
+	if ( ++head == N ) {
+		head = 0;
+	}
+
+	// insertion sort of a copy, N is small
+	int16_t sorted[N];
+	for ( byte i = 0; i < N; ++i ) {
+		int16_t value = window[i];
+		byte j = i;
+		while ( j > 0 && sorted[j - 1] > value ) {
+			sorted[j] = sorted[j - 1];
+			--j;
+		}
+		sorted[j] = value;
+	}
+
+	return sorted[N / 2];
+}
+
+
+/////////////////////////////////////////////////////////////// iir_filter
+
+template <byte SHIFT>
+int16_t iir_filter<SHIFT>::update( int16_t x )
+{
+	state += x - ((state + (1 << SHIFT >> 1)) >> SHIFT);
+	return (state + (1 << SHIFT >> 1)) >> SHIFT;
+}
+
+
+/////////////////////////////////////////////////////////////// kalman_filter
+
+template <uint16_t Q, uint16_t R>
+void kalman_filter<Q, R>::reset( int16_t x )
+{
+	estimate = (int32_t)x * 256;
+	variance = (uint32_t)R << 8;   // first sample is as good as one measurement
+	gain = 0;
+}
+
+
+template <uint16_t Q, uint16_t R>
+int16_t kalman_filter<Q, R>::update( int16_t x )
+{
+	// predict: the temperature may have drifted by Q
+	variance += (uint32_t)Q << 8;
+
+	// correct: gain = P / (P + R), scaled down to a 32 bit division
+	uint32_t p = variance;
+	uint32_t s = variance + ((uint32_t)R << 8);
+	while ( s > 0xFFFF ) {
+		p >>= 1;
+		s >>= 1;
+	}
+	gain = (p << 16) / (s + 1);
+	estimate += ((int64_t)((int32_t)x * 256 - estimate) * gain) >> 16;
+	variance -= ((uint64_t)variance * gain) >> 16;
+
+	return (estimate + 128) >> 8;
+}
+
+
+template <uint16_t Q, uint16_t R>
+uint16_t kalman_filter<Q, R>::group_delay() const
+{
+	// an exponential smoother with gain K lags (1 - K) / K samples
+	if ( gain == 0 ) {
+		return 0;
+	}
+	uint32_t delay = ((uint32_t)(65536UL - gain) << FILTER_DELAY_SHIFT) / gain;
+	return delay > 0xFFFF ? 0xFFFF : delay;
+}
+
+
+#endif // SENSOR_FILTER_HPP
@@ -0,0 +1,201 @@
+#ifndef SERIAL_COMMAND_HPP
+#define SERIAL_COMMAND_HPP
+
+#include "hal.hpp"
+#include "mode_control.hpp"   // MODE_PARAM_*
+
+// Line-based command interface on the serial port.
+// A command is one line of words separated by spaces, ended by CR, LF or
+// both. poll() takes at most COMMAND_POLL_MAX bytes from the UART per call
+// and splits the line into words in place while the bytes come in, so a
+// complete line costs nothing more to parse than a table lookup per word.
+// The buffer is fixed, nothing is allocated; a line too long for it, or with
+// too many words, is dropped up to its end and reported as COMMAND_TOO_LONG.
+// poll() stops at the end of a line, one command is handled per call and the
+// rest waits in the UART buffer.
+//
+//   status                     ok mode <m> temp <C> setpoint <C> segment <n> elapsed <min> duty <0...255> fault <bits> safety <n>
+//   get <parameter>            ok <value>
+//   set <parameter> <value>    ok, in the DEFAULT mode only
+//   start                      ok, in the DEFAULT mode, as START
+//   abort                      ok, in the OPERATION and AUTOTUNE modes, as holding START
+//   ack                        ok, in the ERROR mode, as holding PLUS and MINUS
+//   telemetry on|off           ok, the binary stream
+//   history                    ok, then the run history and the cycle summaries
+//   filter                     ok <ms>, the group delay of the temperature filter
+//   profile on|off             ok, the profiling report (PROFILING builds)
+//   recipe                     ok <segments>, 0 when the barriers are used
+//   recipe <n>                 ok <target> <rate> <hold> <flags> of segment n, from 1
+//   recipe <n> <target> <rate> <hold> [<flags>]
+//                              ok, replaces segment n or appends it after the last, in the DEFAULT mode only
+//   recipe clear               ok, back to the barriers, in the DEFAULT mode only
+//
+// Parameters: temp (C), time (minutes), kp, ki, kd (Q16, 65536 is 1.0).
+// Recipe segments as in recipe.hpp: target C, rate 0.1 C/min, hold minutes, flags.
+// Every line gets one reply line, "ok ..." or "err <reason>" with the reasons
+// long, unknown, syntax, range and mode (not in the current mode).
+
+#define COMMAND_LINE_MAX   32   // characters of a line without its end
+#define COMMAND_WORDS_MAX  6    // a recipe segment with its flags
+#define COMMAND_NAME_MAX   9    // characters of a name in a table
+#define COMMAND_POLL_MAX   32   // bytes taken from the UART per poll(), a whole line of the supervisor
+
+// poll() results
+#define COMMAND_NONE      0
+#define COMMAND_READY     1
+#define COMMAND_TOO_LONG  2
+
+// commands, in the order of command_names
+enum { COMMAND_STATUS, COMMAND_GET, COMMAND_SET, COMMAND_START, COMMAND_ABORT, COMMAND_ACK,
+	   COMMAND_TELEMETRY, COMMAND_HISTORY, COMMAND_FILTER, COMMAND_PROFILE, COMMAND_RECIPE, COMMAND_COUNT };
+
+const char command_names[COMMAND_COUNT][COMMAND_NAME_MAX + 1] PROGMEM = {
+	"status", "get", "set", "start", "abort", "ack", "telemetry", "history", "filter", "profile", "recipe"
+};
+
+// in the order of MODE_PARAM_*
+const char parameter_names[MODE_PARAM_COUNT][COMMAND_NAME_MAX + 1] PROGMEM = {
+	"temp", "time", "kp", "ki", "kd"
+};
+
+const char switch_names[2][COMMAND_NAME_MAX + 1] PROGMEM = { "off", "on" };
+
+const char clear_name[1][COMMAND_NAME_MAX + 1] PROGMEM = { "clear" };
+
+
+class command_line
+{
+	public:
+		command_line();
+
+		// STREAM: HardwareSerial or anything with available() and read(), COMMAND_*
+		template <class STREAM>
+		byte poll( STREAM &serial );
+
+		byte get_count() const;                // words of the line of the last COMMAND_READY
+
+		// index of the word in a table of count names in flash, count if it is none of them or missing
+		byte find( byte word, const char (*names)[COMMAND_NAME_MAX + 1], byte count ) const;
+		bool get_number( byte word, int32_t &value ) const;   // decimal integer, optional sign
+
+	protected:
+		char line[COMMAND_LINE_MAX + 1];       // the words, each ended by 0
+		byte length;
+		byte start[COMMAND_WORDS_MAX];         // of each word in line
+		byte count;
+		bool overflow;                         // the rest of the line is dropped
+		bool done;                             // a line was returned, the next byte starts a new one
+};
+
+
+command_line::command_line()
+			: length(0), count(0), overflow(false), done(false)
+{
+
+}
+
+
+template <class STREAM>
+byte command_line::poll( STREAM &serial )
+{
+	for ( byte n = 0; n < COMMAND_POLL_MAX && serial.available(); ++n ) {
+		if ( done ) {
+			done = false;
+			length = 0;
+			count = 0;
+			overflow = false;
+		}
+
+		char ch = serial.read();
+		if ( ch == '\r' || ch == '\n' ) {
+			if ( !length && !overflow ) {
+				continue;   // empty line, or the LF of a CR LF
+			}
+			done = true;
+			if ( overflow ) {
+				return COMMAND_TOO_LONG;
+			}
+			line[length] = 0;
+			return COMMAND_READY;
+		}
+
+		if ( overflow ) {
+			continue;
+		}
+		if ( length == COMMAND_LINE_MAX ) {
+			overflow = true;
+			continue;
+		}
+		if ( ch == ' ' || ch == '\t' ) {
+			// the first blank after a word ends it, the others are not kept
+			if ( length && line[length - 1] ) {
+				line[length++] = 0;
+			}
+		} else {
+			if ( !length || !line[length - 1] ) {
+				if ( count == COMMAND_WORDS_MAX ) {
+					overflow = true;
+					continue;
+				}
+				start[count++] = length;
+			}
+			line[length++] = ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+		}
+	}
+	return COMMAND_NONE;
+}
+
+
+byte command_line::get_count() const
+{
+	return count;
+}
+
+
+byte command_line::find( byte word, const char (*names)[COMMAND_NAME_MAX + 1], byte names_count ) const
+{
+	if ( word >= count ) {
+		return names_count;
+	}
+	const char *text = line + start[word];
+	for ( byte i = 0; i < names_count; ++i ) {
+		byte c = 0;
+		while ( c <= COMMAND_NAME_MAX && text[c] == (char)pgm_read_byte(&names[i][c]) ) {
+			if ( !text[c] ) {
+				return i;
+			}
+			++c;
+		}
+	}
+	return names_count;
+}
+
+
+bool command_line::get_number( byte word, int32_t &value ) const
+{
+	if ( word >= count ) {
+		return false;
+	}
+	const char *text = line + start[word];
+	bool negative = *text == '-';
+	if ( negative || *text == '+' ) {
+		++text;
+	}
+	// up to 9 digits, no overflow of int32_t
+	byte digits = 0;
+	int32_t number = 0;
+	for ( ; *text; ++text, ++digits ) {
+		if ( *text < '0' || *text > '9' || digits == 9 ) {
+			return false;
+		}
+		number = number * 10 + (*text - '0');
+	}
+	if ( !digits ) {
+		return false;
+	}
+	value = negative ? -number : number;
+	return true;
+}
+
+
+#endif // SERIAL_COMMAND_HPP
@@ -0,0 +1,82 @@
+#ifndef SERIAL_TX_HPP
+#define SERIAL_TX_HPP
+
+#include "hal.hpp"
+
+// Non-blocking transmit ring in front of HardwareSerial.
+// Writers check availableForWrite() and drop what does not fit instead of
+// waiting, pump() moves bytes on to the UART only as far as its own
+// 64 byte buffer has room, so no caller ever blocks on the serial line.
+
+#define SERIAL_TX_SIZE  128   // power of two
+
+
+class serial_tx : public Print
+{
+	public:
+		serial_tx( HardwareSerial &serial );
+
+		virtual size_t write( uint8_t ch );
+		using Print::write;
+		virtual int availableForWrite();
+
+		// Handler, to be called periodically
+		void pump();
+
+		uint16_t get_dropped() const;   // bytes dropped because the ring was full
+
+	protected:
+		HardwareSerial &serial;
+
+		byte buffer[SERIAL_TX_SIZE];
+		byte head;                      // next byte to write
+		byte tail;                      // next byte to send
+		uint16_t dropped;
+};
+
+
+serial_tx::serial_tx( HardwareSerial &s )
+		 : serial(s), head(0), tail(0), dropped(0)
+{
+
+}
+
+
+size_t serial_tx::write( uint8_t ch )
+{
+	byte next = (head + 1) & (SERIAL_TX_SIZE - 1);
+	if ( next == tail ) {
+		if ( dropped < 0xFFFF ) {
+			++dropped;
+		}
+		return 0;
+	}
+	buffer[head] = ch;
+	head = next;
+	return 1;
+}
+
+
+int serial_tx::availableForWrite()
+{
+	return (tail - head - 1) & (SERIAL_TX_SIZE - 1);
+}
+
+
+void serial_tx::pump()
+{
+	int room = serial.availableForWrite();
+	while ( room-- > 0 && tail != head ) {
+		serial.write(buffer[tail]);
+		tail = (tail + 1) & (SERIAL_TX_SIZE - 1);
+	}
+}
+
+
+uint16_t serial_tx::get_dropped() const
+{
+	return dropped;
+}
+
+
+#endif // SERIAL_TX_HPP
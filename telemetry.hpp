@@ -0,0 +1,112 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include "hal.hpp"
+#include "crc16.hpp"
+#include "cobs.hpp"
+
+// Binary telemetry frame, shared by the firmware (encoder) and host/telemetry_decode (decoder).
+//
+// On the wire: 0x00, COBS( payload, CRC-16 ), 0x00
+// Payload, little-endian:
+//   0  u8   frame type (TELEMETRY_SAMPLE)
+//   1  u32  timestamp, ms
+//   5  u16  raw 15-bit RTD code
+//   7  i16  filtered temperature, centi-degrees
+//   9  u8   temperature barier
+//  10  u8   time barier
+//  11  u8   flags (TELEMETRY_HEAT, TELEMETRY_VENT, TELEMETRY_TIMER, TELEMETRY_FAULT)
+//  12  u8   current mode
+//  13  u16  elapsed time, minutes
+//  15  u8   heater duty 0...255
+// The leading delimiter resynchronizes the decoder after any text on the same line.
+
+#define TELEMETRY_SAMPLE        0x01
+
+#define TELEMETRY_HEAT          0x01
+#define TELEMETRY_VENT          0x02
+#define TELEMETRY_TIMER         0x04
+#define TELEMETRY_FAULT         0x08
+
+#define TELEMETRY_PAYLOAD_SIZE  16
+#define TELEMETRY_FRAME_MAX     (COBS_MAX_ENCODED(TELEMETRY_PAYLOAD_SIZE + 2) + 2)
+
+
+struct telemetry_record
+{
+	uint32_t timestamp;
+	uint16_t rtd;
+	int16_t temp;
+	byte temp_barier;
+	byte time_barier;
+	byte flags;
+	byte mode;
+	uint16_t elapsed_time;
+	byte heat_duty;
+};
+
+
+// Builds a complete frame with delimiters, returns its length
+inline byte telemetry_encode( const telemetry_record &r, byte *frame )
+{
+	byte payload[TELEMETRY_PAYLOAD_SIZE + 2];
+
+	payload[0] = TELEMETRY_SAMPLE;
+	payload[1] = r.timestamp;
+	payload[2] = r.timestamp >> 8;
+	payload[3] = r.timestamp >> 16;
+	payload[4] = r.timestamp >> 24;
+	payload[5] = r.rtd;
+	payload[6] = r.rtd >> 8;
+	payload[7] = r.temp;
+	payload[8] = (uint16_t)r.temp >> 8;
+	payload[9] = r.temp_barier;
+	payload[10] = r.time_barier;
+	payload[11] = r.flags;
+	payload[12] = r.mode;
+	payload[13] = r.elapsed_time;
+	payload[14] = r.elapsed_time >> 8;
+	payload[15] = r.heat_duty;
+
+	uint16_t crc = crc16(payload, TELEMETRY_PAYLOAD_SIZE);
+	payload[16] = crc;
+	payload[17] = crc >> 8;
+
+	frame[0] = 0;
+	byte length = cobs_encode(payload, sizeof(payload), frame + 1) + 1;
+	frame[length++] = 0;
+
+	return length;
+}
+
+
+// Decodes one frame without delimiters, returns false if it is not a valid sample
+inline bool telemetry_decode( const byte *frame, byte length, telemetry_record &r )
+{
+	byte payload[TELEMETRY_PAYLOAD_SIZE + 2];
+
+	if ( length > COBS_MAX_ENCODED(sizeof(payload)) || cobs_decode(frame, length, payload) != sizeof(payload) ) {
+		return false;
+	}
+	if ( crc16(payload, TELEMETRY_PAYLOAD_SIZE) != (payload[16] | (uint16_t)payload[17] << 8) ) {
+		return false;
+	}
+	if ( payload[0] != TELEMETRY_SAMPLE ) {
+		return false;
+	}
+
+	r.timestamp = payload[1] | (uint32_t)payload[2] << 8 | (uint32_t)payload[3] << 16 | (uint32_t)payload[4] << 24;
+	r.rtd = payload[5] | (uint16_t)payload[6] << 8;
+	r.temp = payload[7] | (uint16_t)payload[8] << 8;
+	r.temp_barier = payload[9];
+	r.time_barier = payload[10];
+	r.flags = payload[11];
+	r.mode = payload[12];
+	r.elapsed_time = payload[13] | (uint16_t)payload[14] << 8;
+	r.heat_duty = payload[15];
+
+	return true;
+}
+
+
+#endif // TELEMETRY_HPP
@@ -0,0 +1,247 @@
+#ifndef THERMAL_MODEL_HPP
+#define THERMAL_MODEL_HPP
+
+#include "hal.hpp"
+#include "pid_control.hpp"   // Q16
+
+// Online first-order-plus-dead-time model of the oven.
+// Every MODEL_SAMPLE_MS the temperature step is regressed on the temperature,
+// the heater duty one dead time ago and a constant:
+//
+//   T[k+1] - T[k] = a * T[k] / 256 + b * u[k - d] + c
+//
+// a = -256 Ts / tau, b = gain * Ts / tau, c = ambient * Ts / tau, all in degrees.
+// The parameters are tracked with exponentially weighted recursive least
+// squares in Q16, the dead time d is measured on the first heat-up.
+// The model predicts how far the oven coasts after the heater is cut and
+// which duty holds a given temperature.
+
+#define MODEL_SAMPLE_MS      10000             // regression step
+#define MODEL_MAX_DELAY      16                // dead time up to 160 s
+#define MODEL_HORIZON        90                // coast prediction up to 15 min
+#define MODEL_LAMBDA         Q16(0.998)        // forgetting factor, memory of about 80 min
+#define MODEL_P0             Q16(100.0)        // initial covariance, no prior knowledge
+#define MODEL_P_MAX          Q16(400.0)        // covariance trace limit, no wind-up while the input is flat
+#define MODEL_MIN_UPDATES    60                // 10 minutes of data before the model is trusted
+#define MODEL_DEAD_RISE      50                // centi-degrees rise that ends the dead time
+
+
+class thermal_model
+{
+	public:
+		thermal_model();
+
+		void reset();                                        // forget everything
+		void restart();                                      // keep the parameters, new data series with the heater off
+
+		// One regression step, every MODEL_SAMPLE_MS: temperature in centi-degrees
+		// and the mean heater duty 0...255 of the step that just ended
+		void update( int16_t temp, byte duty );
+
+		void set_dead_time( uint32_t ms );                   // measured transport delay
+		bool is_valid() const;                               // enough data and a physical result
+
+		// Highest temperature reached when the heater duty changes to duty now, centi-degrees
+		int16_t predict_peak( int16_t temp, byte duty ) const;
+
+		// Duty that holds the temperature, 0...255
+		byte steady_duty( int16_t temp ) const;
+
+		int32_t get_time_constant() const;                   // s, 0 if not valid
+		int32_t get_gain() const;                            // centi-degrees at full duty, 0 if not valid
+		uint32_t get_dead_time() const;                      // ms, 0 before it was measured
+
+	private:
+		static int32_t temp_regressor( int16_t temp );       // T / 256 degrees in Q16
+		byte delayed_duty( byte steps_back ) const;          // duty steps_back regression steps ago
+
+	protected:
+		int32_t theta[3];                 // a, b, c in Q16
+		int32_t p[3][3];                  // covariance, Q16
+
+		byte duty_history[MODEL_MAX_DELAY + 1];   // ring of step duties, newest at head
+		byte head;
+		byte dead_steps;
+
+		int16_t last_temp;
+		bool have_last;
+		uint16_t updates;
+};
+
+
+thermal_model::thermal_model()
+{
+	reset();
+}
+
+
+void thermal_model::reset()
+{
+	for ( byte i = 0; i < 3; ++i ) {
+		theta[i] = 0;
+		for ( byte j = 0; j < 3; ++j ) {
+			p[i][j] = (i == j) ? MODEL_P0 : 0;
+		}
+	}
+	dead_steps = 0;
+	updates = 0;
+	restart();
+}
+
+
+void thermal_model::restart()
+{
+	for ( byte i = 0; i <= MODEL_MAX_DELAY; ++i ) {
+		duty_history[i] = 0;
+	}
+	head = 0;
+	have_last = false;
+}
+
+
+void thermal_model::update( int16_t temp, byte duty )
+{
+	head = (head + 1) % (MODEL_MAX_DELAY + 1);
+	duty_history[head] = duty;
+
+	if ( !have_last ) {
+		last_temp = temp;
+		have_last = true;
+		return;
+	}
+
+	// regressors and target of the step that just ended
+	int32_t phi[3];
+	phi[0] = temp_regressor(last_temp);
+	phi[1] = ((int32_t)delayed_duty(dead_steps) << Q16_SHIFT) / PID_OUT_MAX;
+	phi[2] = Q16_ONE;
+	int32_t y = (int32_t)(temp - last_temp) * Q16_ONE / 100;
+	last_temp = temp;
+
+	// P phi and phi' P phi
+	int32_t p_phi[3];
+	int64_t phi_p_phi = 0;
+	for ( byte i = 0; i < 3; ++i ) {
+		int64_t sum = 0;
+		for ( byte j = 0; j < 3; ++j ) {
+			sum += (int64_t)p[i][j] * phi[j];
+		}
+		p_phi[i] = sum >> Q16_SHIFT;
+		phi_p_phi += (int64_t)phi[i] * p_phi[i];
+	}
+	int64_t denominator = MODEL_LAMBDA + (phi_p_phi >> Q16_SHIFT);
+
+	// prediction error and gain
+	int64_t estimate = 0;
+	for ( byte i = 0; i < 3; ++i ) {
+		estimate += (int64_t)theta[i] * phi[i];
+	}
+	int32_t error = y - (int32_t)(estimate >> Q16_SHIFT);
+
+	int32_t gain[3];
+	for ( byte i = 0; i < 3; ++i ) {
+		gain[i] = (int64_t)p_phi[i] * Q16_ONE / denominator;
+		theta[i] += ((int64_t)gain[i] * error) >> Q16_SHIFT;
+	}
+
+	// P = (P - K phi' P) / lambda, forgetting only while the trace is bounded
+	int64_t trace = (int64_t)p[0][0] + p[1][1] + p[2][2];
+	bool forget = trace < MODEL_P_MAX;
+	for ( byte i = 0; i < 3; ++i ) {
+		for ( byte j = i; j < 3; ++j ) {
+			int64_t value = p[i][j] - (((int64_t)gain[i] * p_phi[j]) >> Q16_SHIFT);
+			if ( forget ) {
+				value = value * Q16_ONE / MODEL_LAMBDA;
+			}
+			p[i][j] = value;
+			p[j][i] = value;   // kept symmetric
+		}
+	}
+
+	if ( updates < 0xFFFF ) {
+		++updates;
+	}
+}
+
+
+void thermal_model::set_dead_time( uint32_t ms )
+{
+	uint32_t steps = (ms + MODEL_SAMPLE_MS / 2) / MODEL_SAMPLE_MS;
+	dead_steps = steps > MODEL_MAX_DELAY - 1 ? MODEL_MAX_DELAY - 1 : steps;
+}
+
+
+bool thermal_model::is_valid() const
+{
+	// the oven must cool by itself (a < 0) and warm up with the heater (b > 0)
+	return updates >= MODEL_MIN_UPDATES && theta[0] < 0 && theta[1] > 0;
+}
+
+
+int16_t thermal_model::predict_peak( int16_t temp, byte duty ) const
+{
+	// temperature in degrees Q16
+	int32_t t = (int32_t)temp * Q16_ONE / 100;
+	int32_t peak = t;
+
+	for ( byte k = 0; k < MODEL_HORIZON; ++k ) {
+		// heat already on its way arrives for one more dead time, then the new duty
+		int32_t u = ((int32_t)(k < dead_steps ? delayed_duty(dead_steps - 1 - k) : duty) << Q16_SHIFT) / PID_OUT_MAX;
+
+		int64_t step = (int64_t)theta[0] * (t >> 8) + (int64_t)theta[1] * u + (int64_t)theta[2] * Q16_ONE;
+		t += step >> Q16_SHIFT;
+
+		if ( t > peak ) {
+			peak = t;
+		} else if ( k >= dead_steps ) {
+			break;   // falling with the new duty in effect, the peak is behind
+		}
+	}
+
+	return (int64_t)peak * 100 / Q16_ONE;
+}
+
+
+byte thermal_model::steady_duty( int16_t temp ) const
+{
+	if ( !is_valid() ) {
+		return 0;
+	}
+	// 0 = a T / 256 + b u + c
+	int64_t u = -((int64_t)theta[0] * temp_regressor(temp) / Q16_ONE + theta[2]) * PID_OUT_MAX / theta[1];
+	return u < PID_OUT_MIN ? PID_OUT_MIN : u > PID_OUT_MAX ? PID_OUT_MAX : u;
+}
+
+
+int32_t thermal_model::get_time_constant() const
+{
+	return is_valid() ? (int64_t)256 * MODEL_SAMPLE_MS / 1000 * Q16_ONE / -theta[0] : 0;
+}
+
+
+int32_t thermal_model::get_gain() const
+{
+	return is_valid() ? (int64_t)theta[1] * 25600 / -theta[0] : 0;
+}
+
+
+uint32_t thermal_model::get_dead_time() const
+{
+	return (uint32_t)dead_steps * MODEL_SAMPLE_MS;
+}
+
+
+int32_t thermal_model::temp_regressor( int16_t temp )
+{
+	// centi-degrees / 25600 in Q16
+	return (int32_t)temp * 256 / 100;
+}
+
+
+byte thermal_model::delayed_duty( byte steps_back ) const
+{
+	return duty_history[(head + MODEL_MAX_DELAY + 1 - steps_back) % (MODEL_MAX_DELAY + 1)];
+}
+
+
+#endif // THERMAL_MODEL_HPP
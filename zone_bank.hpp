@@ -0,0 +1,328 @@
+#ifndef ZONE_BANK_HPP
+#define ZONE_BANK_HPP
+
+#include "hal.hpp"
+#include "pid_control.hpp"
+#include "heater_output.hpp"  // heater_window
+
+// Zones of a multi-chamber board, per zone state kept as one array per field.
+// Every zone has its own sensor channel and filter. Zone 0 is the chamber run
+// by mode_control and flow_control (recipe, model, autotune, display); zones
+// 1...N-1 follow its setpoint while it operates, each with its own PID and
+// heater and vent relays, and the holds wait for the slowest zone
+// (flow_control::set_zone_span). The follower heaters are switched by
+// heater_tick() from the Timer1 interrupt of zone 0, the control task only
+// publishes their duties. The heater windows of the zones are staggered, so
+// the heaters don't all switch on at the same moment.
+//
+// Per zone: the filter, 2 bytes temperature, 1 byte fault, and for a follower
+// a pid_control and a heater_window. A single zone build keeps no follower
+// state.
+
+#define ZONE_MAX  8   // zones in the bit masks
+
+
+// Followers, zones 1...COUNT: PID, relays and time-proportioning of each
+template <byte COUNT>
+class zone_followers
+{
+	public:
+		// heat_pins, vent_pins: relay pins of the followers in PROGMEM
+		zone_followers( const byte *heat_pins, const byte *vent_pins );
+
+		void init();
+		void control( bool operate, int32_t setpoint, const int16_t *temp );   // temp: of the followers
+		void heater_tick();                                                    // every HEATER_TICK_MS, from the interrupt
+		void set_pid_gains( int32_t kp, int32_t ki, int32_t kd );
+
+		bool get_heat_relay_state( byte follower ) const;
+		byte get_heat_duty( byte follower ) const;
+
+	protected:
+		const byte *heat_pins;
+		const byte *vent_pins;
+
+		pid_control pid[COUNT];
+		heater_window heater[COUNT];
+		bool operating;
+		unsigned long int pid_sample_time;
+};
+
+
+// A single zone has no followers
+template <>
+class zone_followers<0>
+{
+	public:
+		zone_followers( const byte *, const byte * ) {}
+
+		void init() {}
+		void control( bool, int32_t, const int16_t * ) {}
+		void heater_tick() {}
+		void set_pid_gains( int32_t, int32_t, int32_t ) {}
+
+		bool get_heat_relay_state( byte ) const { return false; }
+		byte get_heat_duty( byte ) const { return 0; }
+};
+
+
+template <byte N, class FILTER>
+class zone_bank
+{
+	public:
+		// heat_pins, vent_pins: relay pins of zones 1...N-1 in PROGMEM
+		zone_bank( const byte *heat_pins, const byte *vent_pins );
+
+		void init();
+
+		// One sensor sample of a zone in centi-degrees and its fault status, returns the filtered temperature
+		int16_t sample( byte zone, int16_t temp, byte fault );
+
+		// Followers, to be called with flow_control::control(): operate at setpoint (centi-degrees) or stay off
+		void control( bool operate, int32_t setpoint );
+		void heater_tick();                            // with heater_output::tick(), from the interrupt
+
+		void set_pid_gains( int32_t kp, int32_t ki, int32_t kd );
+
+		int16_t get_temp( byte zone ) const;           // filtered temperature, centi-degrees
+		byte get_fault( byte zone ) const;             // fault status of the last sample
+		byte get_faults() const;                       // bit mask of the zones with a sensor fault
+		int16_t get_coldest() const;                   // lowest zone temperature, centi-degrees
+		int16_t get_hottest() const;                   // highest zone temperature, centi-degrees
+		bool get_heat_relay_state( byte zone ) const;  // zones 1...N-1
+		byte get_heat_duty( byte zone ) const;         // zones 1...N-1
+
+		uint16_t group_delay() const;                  // of the filter, FILTER_DELAY_ONE per sample
+
+	protected:
+		FILTER filter[N];
+		int16_t temp[N];
+		byte fault[N];
+		byte primed;                     // bit mask of the zones with a started filter
+
+		zone_followers<N - 1> followers;
+};
+
+
+/////////////////////////////////////////////////////////////// zone_followers
+
+template <byte COUNT>
+zone_followers<COUNT>::zone_followers( const byte *heat, const byte *vent )
+					  : heat_pins(heat), vent_pins(vent)
+{
+
+}
+
+
+template <byte COUNT>
+void zone_followers<COUNT>::init()
+{
+	for ( byte i = 0; i < COUNT; ++i ) {
+		byte heat = pgm_read_byte(heat_pins + i);
+		byte vent = pgm_read_byte(vent_pins + i);
+		hal::pin_mode(heat, OUTPUT);
+		hal::pin_mode(vent, OUTPUT);
+		hal::digital_write(heat, LOW);
+		hal::digital_write(vent, LOW);
+		pid[i].reset();
+		heater[i].init((unsigned long int)(i + 1) * HEATER_WINDOW_TICKS / (COUNT + 1));   // each zone a fraction of the window later
+	}
+	operating = false;
+	pid_sample_time = 0;
+}
+
+
+template <byte COUNT>
+void zone_followers<COUNT>::control( bool operate, int32_t setpoint, const int16_t *temp )
+{
+	bool sample_due = hal::millis() - pid_sample_time >= PID_SAMPLE_MS;
+	if ( sample_due ) {
+		pid_sample_time = hal::millis();
+	}
+
+	for ( byte i = 0; i < COUNT; ++i ) {
+		if ( !operate ) {
+			if ( operating ) {
+				pid[i].reset();
+			}
+			heater[i].set_duty(0);
+		} else if ( sample_due ) {
+			heater[i].set_duty(pid[i].update( setpoint, temp[i] ));
+		}
+		hal::digital_write(pgm_read_byte(vent_pins + i), operate ? HIGH : LOW);
+	}
+	operating = operate;
+}
+
+
+template <byte COUNT>
+void zone_followers<COUNT>::heater_tick()
+{
+	for ( byte i = 0; i < COUNT; ++i ) {
+		bool was_on = heater[i].is_on();
+		bool on = heater[i].tick();
+		if ( on != was_on ) {
+			hal::digital_write(pgm_read_byte(heat_pins + i), on ? HIGH : LOW);
+		}
+	}
+}
+
+
+template <byte COUNT>
+void zone_followers<COUNT>::set_pid_gains( int32_t kp, int32_t ki, int32_t kd )
+{
+	for ( byte i = 0; i < COUNT; ++i ) {
+		pid[i].set_gains(kp, ki, kd);
+	}
+}
+
+
+template <byte COUNT>
+bool zone_followers<COUNT>::get_heat_relay_state( byte follower ) const
+{
+	return heater[follower].is_on();
+}
+
+
+template <byte COUNT>
+byte zone_followers<COUNT>::get_heat_duty( byte follower ) const
+{
+	return heater[follower].get_duty();
+}
+
+
+/////////////////////////////////////////////////////////////// zone_bank
+
+
+template <byte N, class FILTER>
+zone_bank<N, FILTER>::zone_bank( const byte *heat, const byte *vent )
+					: followers(heat, vent)
+{
+	static_assert(N >= 1 && N <= ZONE_MAX, "1...ZONE_MAX zones");
+}
+
+
+template <byte N, class FILTER>
+void zone_bank<N, FILTER>::init()
+{
+	for ( byte zone = 0; zone < N; ++zone ) {
+		temp[zone] = 0;
+		fault[zone] = 0;
+	}
+	primed = 0;
+
+	followers.init();
+}
+
+
+template <byte N, class FILTER>
+int16_t zone_bank<N, FILTER>::sample( byte zone, int16_t value, byte status )
+{
+	byte bit = 1 << zone;
+	if ( !(primed & bit) ) {
+		filter[zone].reset(value);
+		primed |= bit;
+	}
+
+	fault[zone] = status;
+	temp[zone] = filter[zone].update(value);
+	return temp[zone];
+}
+
+
+template <byte N, class FILTER>
+void zone_bank<N, FILTER>::control( bool operate, int32_t setpoint )
+{
+	followers.control( operate, setpoint, temp + 1 );
+}
+
+
+template <byte N, class FILTER>
+void zone_bank<N, FILTER>::heater_tick()
+{
+	followers.heater_tick();
+}
+
+
+template <byte N, class FILTER>
+void zone_bank<N, FILTER>::set_pid_gains( int32_t kp, int32_t ki, int32_t kd )
+{
+	followers.set_pid_gains(kp, ki, kd);
+}
+
+
+template <byte N, class FILTER>
+int16_t zone_bank<N, FILTER>::get_temp( byte zone ) const
+{
+	return temp[zone];
+}
+
+
+template <byte N, class FILTER>
+byte zone_bank<N, FILTER>::get_fault( byte zone ) const
+{
+	return fault[zone];
+}
+
+
+template <byte N, class FILTER>
+byte zone_bank<N, FILTER>::get_faults() const
+{
+	byte mask = 0;
+	for ( byte zone = 0; zone < N; ++zone ) {
+		if ( fault[zone] ) {
+			mask |= 1 << zone;
+		}
+	}
+	return mask;
+}
+
+
+template <byte N, class FILTER>
+int16_t zone_bank<N, FILTER>::get_coldest() const
+{
+	int16_t coldest = temp[0];
+	for ( byte zone = 1; zone < N; ++zone ) {
+		if ( temp[zone] < coldest ) {
+			coldest = temp[zone];
+		}
+	}
+	return coldest;
+}
+
+
+template <byte N, class FILTER>
+int16_t zone_bank<N, FILTER>::get_hottest() const
+{
+	int16_t hottest = temp[0];
+	for ( byte zone = 1; zone < N; ++zone ) {
+		if ( temp[zone] > hottest ) {
+			hottest = temp[zone];
+		}
+	}
+	return hottest;
+}
+
+
+template <byte N, class FILTER>
+bool zone_bank<N, FILTER>::get_heat_relay_state( byte zone ) const
+{
+	return zone > 0 && zone < N && followers.get_heat_relay_state(zone - 1);
+}
+
+
+template <byte N, class FILTER>
+byte zone_bank<N, FILTER>::get_heat_duty( byte zone ) const
+{
+	return (zone > 0 && zone < N) ? followers.get_heat_duty(zone - 1) : 0;
+}
+
+
+template <byte N, class FILTER>
+uint16_t zone_bank<N, FILTER>::group_delay() const
+{
+	return filter[0].group_delay();
+}
+
+
+#endif // ZONE_BANK_HPP